@@ -7,6 +7,7 @@
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/trace.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -48,6 +49,10 @@
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
 
+/* Most sectors one command can transfer.  The sector count
+   register holds 0 for this many. */
+#define MAX_SECTORS 256
+
 /* An ATA device. */
 struct disk {
 	char name[8];               /* Name, e.g. "hd0:1". */
@@ -84,7 +89,7 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
 
-static void select_sector (struct disk *, disk_sector_t);
+static void select_sector (struct disk *, disk_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -209,47 +214,106 @@ disk_size (struct disk *d) {
    per-disk locking is unneeded. */
 void
 disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
+	disk_read_multiple (d, sec_no, &buffer, 1, 1);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   DISK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
+	disk_write_multiple (d, sec_no, &buffer, 1, 1);
+}
+
+/* Reads BUF_CNT * BUF_SECTORS consecutive sectors, starting at
+   SEC_NO, from disk D.  They go into the BUF_CNT buffers in
+   BUFFERS[] in order, BUF_SECTORS sectors to each.
+   All the sectors of one command are transferred with a single
+   READ SECTOR command, which saves selecting the disk and
+   programming the sector registers for each of them.  A command
+   moves up to 256 sectors. */
+void
+disk_read_multiple (struct disk *d, disk_sector_t sec_no,
+		void *const buffers[], size_t buf_cnt, size_t buf_sectors) {
 	struct channel *c;
+	size_t cnt = buf_cnt * buf_sectors;
+	size_t done = 0;
 
 	ASSERT (d != NULL);
-	ASSERT (buffer != NULL);
+	ASSERT (buffers != NULL);
 
 	c = d->channel;
 	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-	sema_down (&c->completion_wait);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-	input_sector (c, buffer);
-	d->read_cnt++;
+	while (done < cnt) {
+		size_t n = cnt - done < MAX_SECTORS ? cnt - done : MAX_SECTORS;
+		size_t i;
+
+		TRACE (TRACE_DISK_REQUEST, sec_no + done,
+				TRACE_DISK_ARG (c - channels, d->dev_no, false));
+		select_sector (d, sec_no + done, n);
+		issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+		for (i = done; i < done + n; i++) {
+			/* The disk interrupts once each sector is ready. */
+			sema_down (&c->completion_wait);
+			if (!wait_while_busy (d))
+				PANIC ("%s: disk read failed, sector=%"PRDSNu,
+						d->name, (disk_sector_t) (sec_no + i));
+			input_sector (c, (uint8_t *) buffers[i / buf_sectors]
+					+ i % buf_sectors * DISK_SECTOR_SIZE);
+		}
+		d->read_cnt += n;
+		TRACE (TRACE_DISK_DONE, sec_no + done,
+				TRACE_DISK_ARG (c - channels, d->dev_no, false));
+		done += n;
+	}
 	lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   DISK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
+/* Writes BUF_CNT * BUF_SECTORS consecutive sectors, starting at
+   SEC_NO, to disk D, from the BUF_CNT buffers in BUFFERS[] in
+   order, BUF_SECTORS sectors from each.  Returns after the disk
+   has acknowledged receiving all of them.  Like
+   disk_read_multiple(), uses one command per 256 sectors. */
 void
-disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
+disk_write_multiple (struct disk *d, disk_sector_t sec_no,
+		const void *const buffers[], size_t buf_cnt, size_t buf_sectors) {
 	struct channel *c;
+	size_t cnt = buf_cnt * buf_sectors;
+	size_t done = 0;
 
 	ASSERT (d != NULL);
-	ASSERT (buffer != NULL);
+	ASSERT (buffers != NULL);
 
 	c = d->channel;
 	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-	output_sector (c, buffer);
-	sema_down (&c->completion_wait);
-	d->write_cnt++;
+	while (done < cnt) {
+		size_t n = cnt - done < MAX_SECTORS ? cnt - done : MAX_SECTORS;
+		size_t i;
+
+		TRACE (TRACE_DISK_REQUEST, sec_no + done,
+				TRACE_DISK_ARG (c - channels, d->dev_no, true));
+		select_sector (d, sec_no + done, n);
+		issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
+		for (i = done; i < done + n; i++) {
+			/* The disk asks for each sector in turn, and interrupts
+			   once it has taken it. */
+			if (!wait_while_busy (d))
+				PANIC ("%s: disk write failed, sector=%"PRDSNu,
+						d->name, (disk_sector_t) (sec_no + i));
+			output_sector (c, (const uint8_t *) buffers[i / buf_sectors]
+					+ i % buf_sectors * DISK_SECTOR_SIZE);
+			sema_down (&c->completion_wait);
+		}
+		d->write_cnt += n;
+		TRACE (TRACE_DISK_DONE, sec_no + done,
+				TRACE_DISK_ARG (c - channels, d->dev_no, true));
+		done += n;
+	}
 	lock_release (&c->lock);
 }
-
+
 /* Disk detection and identification. */
 
 static void print_ata_string (char *string, size_t size);
@@ -402,17 +466,19 @@ print_ata_string (char *string, size_t size) {
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the number CNT of sectors to transfer, at
+   most MAX_SECTORS, to the disk's sector selection registers.
+   (We use LBA mode.) */
 static void
-select_sector (struct disk *d, disk_sector_t sec_no) {
+select_sector (struct disk *d, disk_sector_t sec_no, size_t cnt) {
 	struct channel *c = d->channel;
 
-	ASSERT (sec_no < d->capacity);
+	ASSERT (cnt > 0 && cnt <= MAX_SECTORS);
+	ASSERT (sec_no + cnt <= d->capacity);
 	ASSERT (sec_no < (1UL << 28));
 
 	select_device_wait (d);
-	outb (reg_nsect (c), 1);
+	outb (reg_nsect (c), cnt == MAX_SECTORS ? 0 : cnt);
 	outb (reg_lbal (c), sec_no);
 	outb (reg_lbam (c), sec_no >> 8);
 	outb (reg_lbah (c), (sec_no >> 16));
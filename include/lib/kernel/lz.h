@@ -0,0 +1,32 @@
+#ifndef __LIB_KERNEL_LZ_H
+#define __LIB_KERNEL_LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* LZ compression.
+
+   A byte-oriented LZ77 compressor in the style of LZ4: it finds
+   earlier occurrences of the input through a small hash table of
+   4-byte sequences, and encodes the input as runs of literal
+   bytes, each followed by a copy from up to 64 kB back.  It is
+   made for speed rather than ratio, on inputs of a page or so.
+
+   Neither function allocates memory.  lz_compress() needs
+   LZ_WORK_SIZE bytes of scratch space from its caller. */
+
+/* Bytes of scratch space that lz_compress() needs. */
+#define LZ_WORK_SIZE (1024 * sizeof (uint16_t))
+
+/* Largest input lz_compress() accepts. */
+#define LZ_MAX_INPUT 65535
+
+/* Returned by lz_decompress() for corrupt input. */
+#define LZ_ERROR SIZE_MAX
+
+size_t lz_compress (const void *src, size_t src_size,
+		void *dst, size_t dst_size, void *work);
+size_t lz_decompress (const void *src, size_t src_size,
+		void *dst, size_t dst_size);
+
+#endif /* lib/kernel/lz.h */
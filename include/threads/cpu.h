@@ -0,0 +1,16 @@
+#ifndef THREADS_CPU_H
+#define THREADS_CPU_H
+
+/* Number of CPUs.  Pintos only ever brings up the bootstrap
+   processor, but per-CPU data is still kept in arrays of
+   CPU_CNT entries indexed by cpu_id(), so that it stays
+   per-CPU if application processors are ever started. */
+#define CPU_CNT 1
+
+/* Returns the index of the running CPU. */
+static inline unsigned
+cpu_id (void) {
+	return 0;
+}
+
+#endif /* threads/cpu.h */
@@ -1,24 +1,52 @@
 #ifndef THREAD_MMU_H
 #define THREAD_MMU_H
 
+#include <list.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include "threads/pte.h"
 
 typedef bool pte_for_each_func (uint64_t *pte, void *va, void *aux);
 
+/* Most pages an mmu_gather invalidates one by one; past that, it
+ * flushes the whole TLB. */
+#define MMU_GATHER_MAX 32
+
+/* TLB invalidations and page frees collected during a bulk
+ * change to the mappings of one address space.  See mmu.c. */
+struct mmu_gather {
+	uint64_t *pml4;                 /* Address space being changed. */
+	size_t cnt;                     /* Number of pages to invalidate. */
+	uint64_t va[MMU_GATHER_MAX];    /* Their addresses, if CNT <= MAX. */
+	struct list free_pages;         /* Pages to free after the flush. */
+};
+
 uint64_t *pml4e_walk (uint64_t *pml4, const uint64_t va, int create);
+uint64_t *pml4e_walk_pde (uint64_t *pml4, const uint64_t va, int create);
+void mmu_init (void);
 uint64_t *pml4_create (void);
 bool pml4_for_each (uint64_t *, pte_for_each_func *, void *);
+bool pml4_for_each_range (uint64_t *, const void *start, const void *end,
+		pte_for_each_func *, void *);
 void pml4_destroy (uint64_t *pml4);
 void pml4_activate (uint64_t *pml4);
+void pml4_flush (uint64_t *pml4);
+void mmu_print_stats (void);
+
+void mmu_gather_init (struct mmu_gather *, uint64_t *pml4);
+void mmu_gather_add (struct mmu_gather *, const void *va);
+void mmu_gather_clear_page (struct mmu_gather *, void *upage);
+void mmu_gather_free_page (struct mmu_gather *, void *page);
+void mmu_gather_finish (struct mmu_gather *);
 void *pml4_get_page (uint64_t *pml4, const void *upage);
 bool pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw);
+bool pml4_set_large_page (uint64_t *pml4, void *upage, void *kpage, bool rw);
 void pml4_clear_page (uint64_t *pml4, void *upage);
 bool pml4_is_dirty (uint64_t *pml4, const void *upage);
 void pml4_set_dirty (uint64_t *pml4, const void *upage, bool dirty);
 bool pml4_is_accessed (uint64_t *pml4, const void *upage);
 void pml4_set_accessed (uint64_t *pml4, const void *upage, bool accessed);
+bool pml4_set_writable (uint64_t *pml4, const void *upage, bool writable);
 
 #define is_writable(pte) (*(pte) & PTE_W)
 #define is_user_pte(pte) (*(pte) & PTE_U)
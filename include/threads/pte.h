@@ -41,5 +41,10 @@
 #define PTE_U 0x4                        /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20                       /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40                       /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80                      /* 1=large page, 0=next table (PDEs, PDPEs). */
+#define PTE_G 0x100                      /* 1=global, kept across CR3 loads (leaf entries). */
+
+/* Size of the page a PDE with PTE_PS set maps. */
+#define LARGE_PGSIZE (1UL << PDXSHIFT)
 
 #endif /* threads/pte.h */
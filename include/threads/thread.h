@@ -132,6 +132,7 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+bool thread_others_ready (void);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
@@ -0,0 +1,67 @@
+#ifndef THREADS_TRACE_H
+#define THREADS_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Static tracepoints.
+ *
+ * Each event is a fixed-size binary record appended to a ring
+ * buffer owned by the CPU that emitted it.  Recording never
+ * takes a lock and never touches the console, so tracepoints may
+ * fire from interrupt handlers, from inside the scheduler, or
+ * while the console lock is held.  The buffers are dumped over
+ * the serial port at power off; utils/trace-decode turns the
+ * dump back into a timeline.
+ *
+ * Tracing is off unless the kernel is started with "-trace" or
+ * "-trace=EVENT,...".  A disabled tracepoint costs one load and
+ * one not-taken branch.  Building with -DNTRACE removes them
+ * entirely. */
+
+/* Event types.  Keep in sync with utils/trace-decode. */
+enum trace_type {
+	TRACE_SCHED_SWITCH,     /* arg0: previous tid, arg1: next tid. */
+	TRACE_PAGE_FAULT,       /* arg0: fault address, arg1: error code. */
+	TRACE_SYSCALL_ENTER,    /* arg0: syscall number, arg1: first argument. */
+	TRACE_SYSCALL_EXIT,     /* arg0: syscall number, arg1: return value. */
+	TRACE_DISK_REQUEST,     /* arg0: sector, arg1: TRACE_DISK_ARG(). */
+	TRACE_DISK_DONE,        /* arg0: sector, arg1: TRACE_DISK_ARG(). */
+	TRACE_LOCK_CONTEND,     /* arg0: lock address, arg1: holder tid. */
+	TRACE_LOCK_ACQUIRED,    /* arg0: lock address, arg1: 0. */
+	TRACE_TYPE_CNT
+};
+
+/* Packs a disk request descriptor for TRACE_DISK_*. */
+#define TRACE_DISK_ARG(CHAN, DEV, WRITE) \
+	((((uint64_t) (CHAN)) << 2) | ((uint64_t) (DEV) << 1) | ((WRITE) ? 1 : 0))
+
+/* One trace record, exactly as stored in the ring and dumped. */
+struct trace_event {
+	uint64_t tsc;           /* Time stamp counter. */
+	uint16_t type;          /* enum trace_type. */
+	uint16_t cpu;           /* Emitting CPU. */
+	int32_t tid;            /* Running thread. */
+	uint64_t arg0;          /* Event-specific arguments. */
+	uint64_t arg1;
+};
+
+/* Bit mask of enabled event types; zero when tracing is off. */
+extern uint32_t trace_mask;
+
+bool trace_parse_option (const char *value);
+void trace_init (void);
+void trace_record (enum trace_type, uint64_t arg0, uint64_t arg1);
+void trace_dump (void);
+
+#ifdef NTRACE
+#define TRACE(TYPE, ARG0, ARG1) ((void) 0)
+#else
+#define TRACE(TYPE, ARG0, ARG1)                                         \
+	do {                                                                \
+		if (__builtin_expect (trace_mask & (1u << (TYPE)), 0))          \
+			trace_record ((TYPE), (uint64_t) (ARG0), (uint64_t) (ARG1));\
+	} while (0)
+#endif
+
+#endif /* threads/trace.h */
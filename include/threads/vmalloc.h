@@ -0,0 +1,25 @@
+#ifndef THREADS_VMALLOC_H
+#define THREADS_VMALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/palloc.h"
+#include "threads/pte.h"
+
+/* Kernel virtual address range for virtually contiguous
+   allocations.  It occupies its own PML4 slot, which every page
+   map level 4 shares with base_pml4. */
+#define VMALLOC_START (2UL << PML4SHIFT)
+#define VMALLOC_SIZE (256UL << 20)
+#define VMALLOC_END (VMALLOC_START + VMALLOC_SIZE)
+
+/* Returns true if VADDR lies in the vmalloc range. */
+#define is_vmalloc_vaddr(vaddr) \
+	((uint64_t) (vaddr) >= VMALLOC_START && (uint64_t) (vaddr) < VMALLOC_END)
+
+void vmalloc_init (void);
+void *vmalloc (enum palloc_flags, size_t page_cnt);
+void vfree (void *, size_t page_cnt);
+
+#endif /* threads/vmalloc.h */
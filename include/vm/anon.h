@@ -1,13 +1,38 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
+#include <list.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "vm/vm.h"
 struct page;
 enum vm_type;
 
+/* Most pages anon_swap_out_multiple() takes at once. */
+#define ANON_SWAP_BATCH 16
+
+/* Most swap slots read on one swap-in, readahead included. */
+#define ANON_RA_MAX 32
+
 struct anon_page {
+	size_t slot;           /* Swap slot, or BITMAP_ERROR if none. */
+	bool readahead;        /* Read ahead, and not faulted on yet? */
+	bool unbacked;         /* Left zswap; the page is the only copy? */
+
+	/* Owned by zswap.c. */
+	size_t zchunk;         /* First chunk in the pool, or BITMAP_ERROR. */
+	uint16_t zsize;        /* Compressed size. */
+	struct list_elem zswap_elem;  /* Element in the pool's LRU list. */
 };
 
+/* Swap slots read on a swap-in, in an aligned window around the
+ * slot faulted on.  Set with -swap-ra. */
+extern size_t anon_ra_window;
+
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+void anon_swap_out_multiple (struct page **pages, size_t cnt, bool *ok);
+bool anon_readahead_hit (struct page *page);
+bool anon_writeback (struct page *page, const void *kva);
+void anon_print_stats (void);
 
 #endif
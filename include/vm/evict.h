@@ -0,0 +1,35 @@
+#ifndef VM_EVICT_H
+#define VM_EVICT_H
+#include <stdbool.h>
+
+struct frame;
+struct page;
+
+/* A page replacement policy.  It holds the frames whose pages are
+ * mapped and not pinned, and picks which of them to evict.  Its
+ * functions are called with the frame table lock held. */
+struct evict_policy {
+	const char *name;
+	void (*init) (void);
+
+	/* FRAME's page was just mapped. */
+	void (*insert) (struct frame *);
+
+	/* FRAME's page is being freed. */
+	void (*remove) (struct frame *);
+
+	/* Takes the frame to evict out of the policy and returns it, or
+	 * returns a null pointer if the policy holds no frames. */
+	struct frame *(*victim) (void);
+
+	/* PAGE, which is not resident, is being freed, or was not
+	 * evicted after all. */
+	void (*forget) (struct page *);
+};
+
+extern const struct evict_policy *evict_policy;
+
+bool evict_parse_option (const char *value);
+void evict_print_stats (void);
+
+#endif /* vm/evict.h */
@@ -0,0 +1,16 @@
+#ifndef VM_KSM_H
+#define VM_KSM_H
+#include <stddef.h>
+
+struct frame;
+
+/* Percentage of the CPU the merging scanner may take, or 0 to not
+ * run it.  Set with -ksm. */
+extern unsigned ksm_cpu_percent;
+
+void ksm_init (void);
+void ksm_insert (struct frame *);
+void ksm_remove (struct frame *);
+void ksm_print_stats (void);
+
+#endif /* vm/ksm.h */
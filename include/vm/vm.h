@@ -1,6 +1,9 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <hash.h>
+#include <list.h>
+#include "filesys/off_t.h"
 #include "threads/palloc.h"
 
 enum vm_type {
@@ -27,12 +30,14 @@ enum vm_type {
 #include "vm/uninit.h"
 #include "vm/anon.h"
 #include "vm/file.h"
+#include "vm/vma.h"
 #ifdef EFILESYS
 #include "filesys/page_cache.h"
 #endif
 
 struct page_operations;
 struct thread;
+struct mmu_gather;
 
 #define VM_TYPE(type) ((type) & 7)
 
@@ -46,6 +51,14 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	struct hash_elem spt_elem;  /* Element in the owner's spt. */
+	uint64_t *pml4;        /* Owner's address space. */
+	struct list_elem frame_elem;  /* Element in its frame's pages. */
+	struct vma *vma;       /* Region the page belongs to. */
+	struct list_elem vma_elem;  /* Element in the region's pages. */
+	bool writable;         /* May the user process write the page? */
+	struct list_elem ghost_elem;  /* Remembered by evict.c, if GHOST. */
+	int ghost;             /* Which evict.c queue remembers it, or 0. */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -59,10 +72,38 @@ struct page {
 	};
 };
 
-/* The representation of "frame" */
+/* The representation of "frame".
+ * After fork(), the parent's and the child's copies of an anonymous
+ * page share one frame, mapped read-only in both, until one of them
+ * writes to it.  PAGES holds every page the frame backs. */
 struct frame {
 	void *kva;
-	struct page *page;
+	struct page *page;     /* First of PAGES, or NULL. */
+
+	struct list pages;     /* Pages it backs, by frame_elem. */
+	size_t ref_cnt;        /* Number of PAGES. */
+	bool pinned;           /* Being set up; not to be evicted. */
+	bool evicting;         /* Its pages are being written out. */
+
+	/* A frame that holds a page of an executable's text is found
+	 * by its place in the file, so that every process running the
+	 * executable maps the same frame. */
+	struct hash_elem text_elem;  /* Element in vm.c's text table. */
+	struct inode *inode;   /* File it holds text of, or NULL. */
+	off_t offset;          /* Offset in the file. */
+	size_t read_bytes;     /* Bytes read from there; zeros follow. */
+
+	/* Owned by the replacement policy in evict.c. */
+	struct list_elem elem; /* Element in one of its queues. */
+	int queue;             /* Which one. */
+	bool skipped;          /* Passed over once already. */
+
+	/* Owned by the merging scanner in ksm.c. */
+	struct list_elem ksm_elem;       /* Element in its ring. */
+	struct hash_elem ksm_hash_elem;  /* Element in its stable table. */
+	uint64_t checksum;     /* Of the contents when last scanned. */
+	bool ksm_stable;       /* In the stable table? */
+	bool ksm_merged;       /* Have other pages been merged into it? */
 };
 
 /* The function table for page operations.
@@ -85,6 +126,8 @@ struct page_operations {
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
 struct supplemental_page_table {
+	struct vma_tree vmas;  /* Regions of the address space. */
+	struct hash pages;     /* Pages touched so far, keyed by va. */
 };
 
 #include "threads/thread.h"
@@ -97,7 +140,11 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
 
+/* Guards the frames and their links to pages.  See vm.c. */
+extern struct lock frame_lock;
+
 void vm_init (void);
+void vm_print_stats (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -105,8 +152,14 @@ bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 	vm_alloc_page_with_initializer ((type), (upage), (writable), NULL, NULL)
 bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
+bool vm_map_region (enum vm_type type, void *start, size_t page_cnt,
+		bool writable, struct file *file, off_t ofs, size_t read_bytes);
+bool vm_unmap_region (void *start, size_t page_cnt);
 void vm_dealloc_page (struct page *page);
+void vm_release_page (struct page *page, struct mmu_gather *tlb);
 bool vm_claim_page (void *va);
+bool vm_cache_page (struct page *page, void *kva);
+bool vm_merge_frames (struct frame *keep, struct frame *dup);
 enum vm_type page_get_type (struct page *page);
 
 #endif  /* VM_VM_H */
@@ -0,0 +1,63 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+#include "vm/vm.h"
+
+/* A virtual memory area: a page-aligned range of user addresses
+ * whose pages share one backing and one set of permissions.
+ *
+ * A process's regions are registered up front, one VMA each, and
+ * the `struct page's of a region are only created when one of its
+ * pages is first touched.  Setting up an address space thus costs
+ * O(regions), whatever their size. */
+struct vma {
+	uint8_t *start;             /* First address, page aligned. */
+	uint8_t *end;               /* One past the last, page aligned. */
+	enum vm_type type;          /* Type of the pages, with markers. */
+	bool writable;              /* May the user process write? */
+
+	/* Backing.  If FILE is nonnull, the first READ_BYTES bytes of
+	 * the region are read from FILE starting at OFFSET.  Otherwise
+	 * INIT, if nonnull, is called with AUX to fill each page.
+	 * Everything else is zero. */
+	struct file *file;          /* Owned; closed with the VMA. */
+	off_t offset;               /* Offset in FILE of START. */
+	size_t read_bytes;          /* Bytes of FILE mapped at START. */
+	vm_initializer *init;
+	void *aux;
+
+	struct list pages;          /* Materialized pages, by vma_elem. */
+
+	/* Interval tree node, owned by vma.c. */
+	struct vma *parent, *left, *right;
+	int height;                 /* Height of the subtree, 1 for a leaf. */
+	uint8_t *max_end;           /* Greatest END in the subtree. */
+};
+
+/* An interval tree of VMAs: an AVL tree ordered by START, with
+ * each node augmented by the greatest END below it.  The VMAs of
+ * a tree never overlap. */
+struct vma_tree {
+	struct vma *root;
+	size_t cnt;
+};
+
+void vma_tree_init (struct vma_tree *);
+bool vma_insert (struct vma_tree *, struct vma *);
+void vma_remove (struct vma_tree *, struct vma *);
+void vma_update (struct vma *);
+struct vma *vma_find (struct vma_tree *, const void *va);
+struct vma *vma_first_overlap (struct vma_tree *, const void *start,
+		const void *end);
+struct vma *vma_first (struct vma_tree *);
+struct vma *vma_next (struct vma *);
+
+size_t vma_file_bytes (const struct vma *, const void *upage, off_t *ofs);
+bool vma_read (const struct vma *, const void *upage, void *kva);
+void vma_write (const struct vma *, const void *upage, const void *kva);
+
+#endif /* vm/vma.h */
@@ -0,0 +1,18 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+#include <stdbool.h>
+#include <stddef.h>
+
+struct page;
+
+/* Pages of kernel memory set aside for compressed pages, or 0 to
+ * go straight to the swap disk.  Set with -zswap. */
+extern size_t zswap_pool_pages;
+
+void zswap_init (void);
+bool zswap_store (struct page *page, const void *kva);
+bool zswap_load (struct page *page, void *kva, bool keep);
+void zswap_invalidate (struct page *page);
+void zswap_print_stats (void);
+
+#endif /* vm/zswap.h */
@@ -4,6 +4,7 @@
 #include <round.h>
 #include <stdio.h>
 #include "threads/malloc.h"
+#include "intrinsic.h"
 #ifdef FILESYS
 #include "filesys/file.h"
 #endif
@@ -26,6 +27,7 @@ typedef unsigned long elem_type;
    simulates an array of bits. */
 struct bitmap {
 	size_t bit_cnt;     /* Number of bits. */
+	size_t hint;        /* Where the next next-fit scan starts. */
 	elem_type *bits;    /* Elements that represent bits. */
 };
 
@@ -63,6 +65,74 @@ last_mask (const struct bitmap *b) {
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns ELEM with every bit inverted if VALUE is false, so
+   that the bits equal to VALUE are the ones that are set. */
+static inline elem_type
+match_bits (elem_type elem, bool value) {
+	return value ? elem : ~elem;
+}
+
+/* Returns a mask of the bits of an element from bit OFS up. */
+static inline elem_type
+mask_from (size_t ofs) {
+	return (elem_type) -1 << ofs;
+}
+
+/* Returns a mask of the N bits of an element from bit OFS up. */
+static inline elem_type
+range_mask (size_t ofs, size_t n) {
+	elem_type bits = n < ELEM_BITS ? ((elem_type) 1 << n) - 1 : (elem_type) -1;
+	return bits << ofs;
+}
+
+/* Returns the index of the first bit in B at or after START that
+   is set to VALUE, or B's size if there is none.  Skips whole
+   elements that hold no such bit. */
+static size_t
+find_next (const struct bitmap *b, size_t start, bool value) {
+	size_t idx = elem_idx (start);
+	size_t cnt = elem_cnt (b->bit_cnt);
+	elem_type bits;
+
+	if (start >= b->bit_cnt)
+		return b->bit_cnt;
+
+	bits = match_bits (b->bits[idx], value) & mask_from (start % ELEM_BITS);
+	while (bits == 0) {
+		if (++idx >= cnt)
+			return b->bit_cnt;
+		bits = match_bits (b->bits[idx], value);
+	}
+
+	/* The unused bits of the last element may look like a match. */
+	start = idx * ELEM_BITS + __builtin_ctzl (bits);
+	return start < b->bit_cnt ? start : b->bit_cnt;
+}
+
+/* Returns the number of set bits in X. */
+static inline size_t
+popcount (elem_type x) {
+	static int has_popcnt = -1;
+
+	if (has_popcnt < 0) {
+		uint32_t eax, ebx, ecx, edx;
+		cpuid (1, 0, &eax, &ebx, &ecx, &edx);
+		has_popcnt = (ecx >> 23) & 1;
+	}
+
+	if (has_popcnt) {
+		elem_type cnt;
+		asm ("popcnt %1, %0" : "=r" (cnt) : "rm" (x) : "cc");
+		return cnt;
+	}
+
+	/* Count bits in pairs, nibbles and bytes, then sum the bytes. */
+	x = x - ((x >> 1) & 0x5555555555555555UL);
+	x = (x & 0x3333333333333333UL) + ((x >> 2) & 0x3333333333333333UL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fUL;
+	return (x * 0x0101010101010101UL) >> 56;
+}
+
 /* Creation and destruction. */
 
 /* Initializes B to be a bitmap of BIT_CNT bits
@@ -74,6 +144,7 @@ bitmap_create (size_t bit_cnt) {
 	struct bitmap *b = malloc (sizeof *b);
 	if (b != NULL) {
 		b->bit_cnt = bit_cnt;
+		b->hint = 0;
 		b->bits = malloc (byte_cnt (bit_cnt));
 		if (b->bits != NULL || bit_cnt == 0) {
 			bitmap_set_all (b, false);
@@ -94,6 +165,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED) {
 	ASSERT (block_size >= bitmap_buf_size (bit_cnt));
 
 	b->bit_cnt = bit_cnt;
+	b->hint = 0;
 	b->bits = (elem_type *) (b + 1);
 	bitmap_set_all (b, false);
 	return b;
@@ -194,50 +266,62 @@ bitmap_set_all (struct bitmap *b, bool value) {
 	bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element is updated atomically, but not the group as a
+   whole. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
+	size_t end = start + cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		bitmap_set (b, start + i, value);
+	while (start < end) {
+		size_t idx = elem_idx (start);
+		size_t ofs = start % ELEM_BITS;
+		size_t n = ELEM_BITS - ofs < end - start ? ELEM_BITS - ofs : end - start;
+		elem_type mask = range_mask (ofs, n);
+
+		if (value)
+			asm ("lock orq %1, %0" : "+m" (b->bits[idx]) : "r" (mask) : "cc");
+		else
+			asm ("lock andq %1, %0" : "+m" (b->bits[idx]) : "r" (~mask) : "cc");
+		start += n;
+	}
 }
 
 /* Returns the number of bits in B between START and START + CNT,
    exclusive, that are set to VALUE. */
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i, value_cnt;
+	size_t end = start + cnt;
+	size_t ones = 0;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	value_cnt = 0;
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			value_cnt++;
-	return value_cnt;
+	while (start < end) {
+		size_t ofs = start % ELEM_BITS;
+		size_t n = ELEM_BITS - ofs < end - start ? ELEM_BITS - ofs : end - start;
+		elem_type mask = range_mask (ofs, n);
+
+		ones += popcount (b->bits[elem_idx (start)] & mask);
+		start += n;
+	}
+	return value ? ones : cnt - ones;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			return true;
-	return false;
+	return cnt > 0 && find_next (b, start, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -266,18 +350,29 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt) {
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Rather than testing each starting index in turn, jumps from
+   the start of each run of VALUE bits straight to its end, and
+   from there to the start of the next run, a word at a time.
+   This takes time linear in the size of B. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 
-	if (cnt <= b->bit_cnt) {
-		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
-				return i;
+	if (cnt == 0)
+		return start;
+	while (cnt <= b->bit_cnt - start) {
+		size_t end;
+
+		start = find_next (b, start, value);
+		if (cnt > b->bit_cnt - start)
+			break;
+		end = find_next (b, start, !value);
+		if (end - start >= cnt)
+			return start;
+		start = end;
 	}
 	return BITMAP_ERROR;
 }
@@ -297,6 +392,29 @@ bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value) {
 	return idx;
 }
 
+/* Like bitmap_scan_and_flip(), but searches "next fit": starts
+   where the previous call to this function on B left off and
+   wraps around to the beginning of B.  This spreads allocations
+   across B and avoids rescanning the full groups that tend to
+   build up at its start. */
+size_t
+bitmap_scan_and_flip_next (struct bitmap *b, size_t cnt, bool value) {
+	size_t idx;
+
+	ASSERT (b != NULL);
+
+	if (b->hint > b->bit_cnt)
+		b->hint = 0;
+	idx = bitmap_scan (b, b->hint, cnt, value);
+	if (idx == BITMAP_ERROR && b->hint > 0)
+		idx = bitmap_scan (b, 0, cnt, value);
+	if (idx != BITMAP_ERROR) {
+		bitmap_set_multiple (b, idx, cnt, !value);
+		b->hint = idx + cnt;
+	}
+	return idx;
+}
+
 /* File input and output. */
 
 #ifdef FILESYS
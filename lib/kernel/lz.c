@@ -0,0 +1,184 @@
+#include "lz.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* Compressed format.
+
+   The output is a series of sequences.  Each one starts with a
+   token byte, whose upper 4 bits give the number of literal
+   bytes that follow and whose lower 4 bits give the length of
+   the match after them, less MIN_MATCH.  A field of 15 means the
+   length goes on in the next bytes, which are added to it until
+   one is less than 255.  The literals come right after the
+   literal length.  The match is given by a 2-byte little-endian
+   offset back from the current output position, followed by the
+   rest of the match length.  The last sequence ends after its
+   literals, with the input. */
+
+/* Shortest match worth encoding. */
+#define MIN_MATCH 4
+
+/* Log2 of the number of entries in the hash table. */
+#define HASH_BITS 10
+
+/* Returns the 4 bytes at P as a little-endian integer. */
+static inline uint32_t
+read32 (const uint8_t *p) {
+	return p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16
+		| (uint32_t) p[3] << 24;
+}
+
+/* Returns the hash table index for the 4-byte sequence SEQ. */
+static inline size_t
+hash (uint32_t seq) {
+	return (seq * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Appends the continuation of a length field of LEN to *OP,
+   unless that would pass END.  Returns true if successful. */
+static bool
+put_length (uint8_t **op, uint8_t *end, size_t len) {
+	if (len < 15)
+		return true;
+	for (len -= 15; len >= 255; len -= 255) {
+		if (*op >= end)
+			return false;
+		*(*op)++ = 255;
+	}
+	if (*op >= end)
+		return false;
+	*(*op)++ = len;
+	return true;
+}
+
+/* Appends a sequence of the LIT_CNT bytes at LIT followed by a
+   match of MATCH_LEN bytes OFFSET bytes back to *OP, unless that
+   would pass END.  A MATCH_LEN of 0 makes it the last sequence.
+   Returns true if successful. */
+static bool
+put_sequence (uint8_t **op, uint8_t *end, const uint8_t *lit,
+		size_t lit_cnt, size_t offset, size_t match_len) {
+	size_t extra = match_len > 0 ? match_len - MIN_MATCH : 0;
+
+	if (*op >= end)
+		return false;
+	*(*op)++ = (lit_cnt < 15 ? lit_cnt : 15) << 4 | (extra < 15 ? extra : 15);
+	if (!put_length (op, end, lit_cnt) || (size_t) (end - *op) < lit_cnt)
+		return false;
+	memcpy (*op, lit, lit_cnt);
+	*op += lit_cnt;
+
+	if (match_len > 0) {
+		if (end - *op < 2)
+			return false;
+		*(*op)++ = offset & 0xff;
+		*(*op)++ = offset >> 8;
+		if (!put_length (op, end, extra))
+			return false;
+	}
+	return true;
+}
+
+/* Compresses the SRC_SIZE bytes at SRC, at most LZ_MAX_INPUT,
+   into the DST_SIZE bytes at DST.  WORK must point to
+   LZ_WORK_SIZE bytes of scratch space.  Returns the size of the
+   compressed data, or 0 if it does not fit in DST_SIZE bytes. */
+size_t
+lz_compress (const void *src_, size_t src_size, void *dst_,
+		size_t dst_size, void *work) {
+	const uint8_t *src = src_;
+	uint8_t *dst = dst_, *op = dst, *end = dst + dst_size;
+	uint16_t *table = work;   /* Position + 1 of a sequence, or 0. */
+	size_t anchor = 0;        /* Start of the pending literals. */
+	size_t i = 0;
+
+	ASSERT (src_size <= LZ_MAX_INPUT);
+
+	memset (table, 0, LZ_WORK_SIZE);
+	while (i + MIN_MATCH <= src_size) {
+		uint32_t seq = read32 (src + i);
+		size_t h = hash (seq);
+		size_t cand = table[h];
+		size_t len;
+
+		table[h] = i + 1;
+		if (cand == 0 || read32 (src + --cand) != seq) {
+			/* Skip ahead faster the longer nothing matched, so that
+			   incompressible input is given up on cheaply. */
+			i += 1 + ((i - anchor) >> 5);
+			continue;
+		}
+
+		for (len = MIN_MATCH; i + len < src_size
+				&& src[cand + len] == src[i + len]; len++)
+			continue;
+		if (!put_sequence (&op, end, src + anchor, i - anchor, i - cand, len))
+			return 0;
+		i += len;
+		anchor = i;
+	}
+	if (!put_sequence (&op, end, src + anchor, src_size - anchor, 0, 0))
+		return 0;
+	return op - dst;
+}
+
+/* Reads the continuation of a length field of *LEN from *IP,
+   which must not pass END.  Returns true if successful. */
+static bool
+get_length (const uint8_t **ip, const uint8_t *end, size_t *len) {
+	uint8_t b;
+
+	if (*len < 15)
+		return true;
+	do {
+		if (*ip >= end)
+			return false;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+/* Decompresses the SRC_SIZE bytes at SRC, which lz_compress()
+   produced, into the DST_SIZE bytes at DST.  Returns the size of
+   the decompressed data, or LZ_ERROR if SRC is corrupt or would
+   not fit in DST_SIZE bytes. */
+size_t
+lz_decompress (const void *src_, size_t src_size, void *dst_,
+		size_t dst_size) {
+	const uint8_t *ip = src_, *iend = ip + src_size;
+	uint8_t *dst = dst_, *op = dst, *oend = dst + dst_size;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		size_t len = token >> 4, offset, k;
+
+		if (!get_length (&ip, iend, &len)
+				|| (size_t) (iend - ip) < len || (size_t) (oend - op) < len)
+			return LZ_ERROR;
+		memcpy (op, ip, len);
+		ip += len;
+		op += len;
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return LZ_ERROR;
+		offset = ip[0] | (size_t) ip[1] << 8;
+		ip += 2;
+		len = token & 15;
+		if (!get_length (&ip, iend, &len))
+			return LZ_ERROR;
+		len += MIN_MATCH;
+		if (offset == 0 || offset > (size_t) (op - dst)
+				|| (size_t) (oend - op) < len)
+			return LZ_ERROR;
+
+		/* The match may overlap the bytes it produces. */
+		for (k = 0; k < len; k++)
+			op[k] = op[k - offset];
+		op += len;
+	}
+	return op - dst;
+}
@@ -0,0 +1,225 @@
+/* Checks bitmap_scan(), bitmap_count(), bitmap_contains() and
+   bitmap_set_multiple(), which work a word at a time, against a
+   plain array of bools.  Bitmaps of sizes on both sides of a word
+   boundary are filled with several patterns, and each operation
+   is tried from every starting bit. */
+
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include "tests/threads/tests.h"
+
+/* Largest bitmap tried. */
+#define MAX_BITS 513
+
+static const size_t sizes[] = { 1, 63, 64, 65, 200, MAX_BITS };
+static const size_t cnts[] = { 0, 1, 2, 3, 7, 8, 31, 63, 64, 65, 130 };
+
+#define ARRAY_CNT(A) (sizeof (A) / sizeof *(A))
+
+enum pattern { CLEAR, SET, RANDOM, SPARSE, RUNS, PATTERN_CNT };
+
+/* Shadow of the bitmap under test. */
+static bool bits[MAX_BITS];
+
+/* RUN[V][I] is the number of bits equal to V starting at bit I. */
+static size_t run[2][MAX_BITS + 1];
+
+/* ONES[I] is the number of set bits before bit I. */
+static size_t ones[MAX_BITS + 1];
+
+static void fill (struct bitmap *, size_t bit_cnt, enum pattern);
+static void index_bits (size_t bit_cnt);
+static void check_bitmap (const struct bitmap *, size_t bit_cnt);
+static void check_set_multiple (struct bitmap *, size_t bit_cnt);
+static void check_flip_next (size_t bit_cnt);
+
+void
+test_bitmap_ops (void)
+{
+  size_t i;
+
+  random_init (0);
+  for (i = 0; i < ARRAY_CNT (sizes); i++)
+    {
+      size_t bit_cnt = sizes[i];
+      struct bitmap *b = bitmap_create (bit_cnt);
+      enum pattern p;
+
+      if (b == NULL)
+        fail ("bitmap_create(%zu) failed", bit_cnt);
+      for (p = 0; p < PATTERN_CNT; p++)
+        {
+          fill (b, bit_cnt, p);
+          check_bitmap (b, bit_cnt);
+        }
+      check_set_multiple (b, bit_cnt);
+      bitmap_destroy (b);
+      check_flip_next (bit_cnt);
+    }
+  pass ();
+}
+
+/* Sets the BIT_CNT bits of B and of BITS according to P. */
+static void
+fill (struct bitmap *b, size_t bit_cnt, enum pattern p)
+{
+  size_t i;
+
+  for (i = 0; i < bit_cnt; i++)
+    {
+      switch (p)
+        {
+        case CLEAR:
+          bits[i] = false;
+          break;
+        case SET:
+          bits[i] = true;
+          break;
+        case RANDOM:
+          bits[i] = random_ulong () % 2;
+          break;
+        case SPARSE:
+          bits[i] = random_ulong () % 16 == 0;
+          break;
+        case RUNS:
+          /* Runs that average 80 bits, so that most span words. */
+          if (i > 0 && random_ulong () % 40 != 0)
+            bits[i] = bits[i - 1];
+          else
+            bits[i] = random_ulong () % 2;
+          break;
+        default:
+          NOT_REACHED ();
+        }
+      bitmap_set (b, i, bits[i]);
+    }
+}
+
+/* Recomputes RUN and ONES from the first BIT_CNT entries of BITS. */
+static void
+index_bits (size_t bit_cnt)
+{
+  size_t i;
+
+  run[0][bit_cnt] = run[1][bit_cnt] = 0;
+  for (i = bit_cnt; i-- > 0; )
+    {
+      run[bits[i]][i] = run[bits[i]][i + 1] + 1;
+      run[!bits[i]][i] = 0;
+    }
+  ones[0] = 0;
+  for (i = 0; i < bit_cnt; i++)
+    ones[i + 1] = ones[i] + bits[i];
+}
+
+/* Returns the first group of CNT bits equal to VALUE at or after
+   START, found the slow way, or BITMAP_ERROR. */
+static size_t
+expected_scan (size_t bit_cnt, size_t start, size_t cnt, bool value)
+{
+  size_t i;
+
+  for (i = start; i + cnt <= bit_cnt; i++)
+    if (run[value][i] >= cnt)
+      return i;
+  return BITMAP_ERROR;
+}
+
+/* Checks B against BITS, from every starting bit. */
+static void
+check_bitmap (const struct bitmap *b, size_t bit_cnt)
+{
+  size_t start, i;
+  int value;
+
+  index_bits (bit_cnt);
+  for (i = 0; i < bit_cnt; i++)
+    if (bitmap_test (b, i) != bits[i])
+      fail ("bit %zu of %zu is %d, not %d", i, bit_cnt,
+            bitmap_test (b, i), bits[i]);
+
+  for (start = 0; start <= bit_cnt; start++)
+    for (i = 0; i < ARRAY_CNT (cnts); i++)
+      for (value = 0; value <= 1; value++)
+        {
+          size_t cnt = cnts[i];
+          size_t expected = expected_scan (bit_cnt, start, cnt, value);
+          size_t actual = bitmap_scan (b, start, cnt, value);
+
+          if (actual != expected)
+            fail ("scan of %zu bits for %zu %d-bits from bit %zu "
+                  "returned %zu, not %zu",
+                  bit_cnt, cnt, value, start, actual, expected);
+
+          if (cnt > bit_cnt - start)
+            continue;
+          expected = value ? ones[start + cnt] - ones[start]
+                           : cnt - (ones[start + cnt] - ones[start]);
+          actual = bitmap_count (b, start, cnt, value);
+          if (actual != expected)
+            fail ("count of %d-bits in bits %zu...%zu of %zu "
+                  "returned %zu, not %zu",
+                  value, start, start + cnt, bit_cnt, actual, expected);
+          if (bitmap_contains (b, start, cnt, value) != (expected > 0))
+            fail ("bitmap_contains (%zu, %zu, %d) on %zu bits is wrong",
+                  start, cnt, value, bit_cnt);
+        }
+}
+
+/* Sets and clears runs of bits at every offset, and checks that
+   exactly those bits changed. */
+static void
+check_set_multiple (struct bitmap *b, size_t bit_cnt)
+{
+  size_t start, i, j;
+
+  for (start = 0; start < bit_cnt; start++)
+    for (i = 0; i < ARRAY_CNT (cnts); i++)
+      {
+        size_t cnt = cnts[i];
+        bool value = (start + i) % 2;
+
+        if (cnt > bit_cnt - start)
+          continue;
+        bitmap_set_multiple (b, start, cnt, value);
+        for (j = start; j < start + cnt; j++)
+          bits[j] = value;
+        for (j = 0; j < bit_cnt; j++)
+          if (bitmap_test (b, j) != bits[j])
+            fail ("after setting bits %zu...%zu of %zu to %d, "
+                  "bit %zu is wrong", start, start + cnt, bit_cnt,
+                  value, j);
+      }
+}
+
+/* Allocates groups of clear bits with bitmap_scan_and_flip_next()
+   until the bitmap is full, frees some, and checks that the next
+   allocations wrap around to find them. */
+static void
+check_flip_next (size_t bit_cnt)
+{
+  struct bitmap *b = bitmap_create (bit_cnt);
+  size_t idx, next = 0;
+
+  if (b == NULL)
+    fail ("bitmap_create(%zu) failed", bit_cnt);
+  while ((idx = bitmap_scan_and_flip_next (b, 1, false)) != BITMAP_ERROR)
+    {
+      if (idx != next)
+        fail ("next-fit allocation %zu of %zu returned bit %zu",
+              next, bit_cnt, idx);
+      next++;
+    }
+  if (next != bit_cnt)
+    fail ("next-fit allocation filled %zu of %zu bits", next, bit_cnt);
+
+  bitmap_reset (b, 0);
+  idx = bitmap_scan_and_flip_next (b, 1, false);
+  if (idx != 0)
+    fail ("next-fit allocation did not wrap around to bit 0 of %zu, "
+          "but returned %zu", bit_cnt, idx);
+  if (!bitmap_all (b, 0, bit_cnt))
+    fail ("next-fit allocation left clear bits in %zu", bit_cnt);
+  bitmap_destroy (b);
+}
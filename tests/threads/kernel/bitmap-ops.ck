@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(bitmap-ops) begin
+(bitmap-ops) PASS
+(bitmap-ops) end
+EOF
+pass;
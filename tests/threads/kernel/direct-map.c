@@ -0,0 +1,85 @@
+/* Walks the kernel's direct map of physical memory in base_pml4
+   and checks how it is built.  Every page from physical address
+   0 up must be mapped, globally, to the matching physical page.
+   Each 2 MB-aligned range that lies wholly outside the kernel
+   text must be mapped with one 2 MB page.  The pages of the text
+   must be mapped with 4 kB pages, read-only. */
+
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+
+static uint64_t *lookup (uint64_t pa);
+static bool in_text (uint64_t va, size_t size);
+
+void
+test_direct_map (void)
+{
+  extern char _end_kernel_text;
+  void *page = palloc_get_page (PAL_USER | PAL_ASSERT);
+  size_t large_cnt = 0;
+  uint64_t pa, end;
+
+  /* Find where the direct map ends. */
+  for (pa = 0; lookup (pa) != NULL; )
+    pa += *lookup (pa) & PTE_PS ? LARGE_PGSIZE : PGSIZE;
+  end = pa;
+  if (end <= vtop (page))
+    fail ("direct map ends at %#llx, below page %#llx of the user pool",
+          end, vtop (page));
+  if (end <= vtop (&_end_kernel_text))
+    fail ("direct map ends at %#llx, inside the kernel text", end);
+  palloc_free_page (page);
+
+  for (pa = 0; pa < end; )
+    {
+      uint64_t va = (uint64_t) ptov (pa);
+      uint64_t *pte = lookup (pa);
+      bool want_large = pa % LARGE_PGSIZE == 0 && end - pa >= LARGE_PGSIZE
+                        && !in_text (va, LARGE_PGSIZE);
+      size_t size;
+
+      if (!(*pte & PTE_G))
+        fail ("direct map of %#llx is not global", pa);
+      if (want_large != !!(*pte & PTE_PS))
+        fail ("direct map of %#llx uses a %s page", pa,
+              *pte & PTE_PS ? "2 MB" : "4 kB");
+      size = *pte & PTE_PS ? LARGE_PGSIZE : PGSIZE;
+      large_cnt += size == LARGE_PGSIZE;
+
+      if (PTE_ADDR (*pte) != pa)
+        fail ("direct map of %#llx points to %#llx", pa, PTE_ADDR (*pte));
+      if (in_text (va, PGSIZE) == !!(*pte & PTE_W))
+        fail ("direct map of %#llx is %s", pa,
+              *pte & PTE_W ? "writable, in the kernel text"
+                           : "read-only, outside the kernel text");
+      pa += size;
+    }
+
+  if (large_cnt == 0)
+    fail ("no 2 MB pages in the direct map");
+  pass ();
+}
+
+/* Returns the entry in base_pml4 that maps physical address PA
+   in the direct map, or a null pointer if there is none. */
+static uint64_t *
+lookup (uint64_t pa)
+{
+  uint64_t *pte = pml4e_walk (base_pml4, (uint64_t) ptov (pa), 0);
+
+  return pte != NULL && (*pte & PTE_P) ? pte : NULL;
+}
+
+/* Returns true if any of the SIZE bytes at VA are kernel text. */
+static bool
+in_text (uint64_t va, size_t size)
+{
+  extern char start, _end_kernel_text;
+
+  return va < (uint64_t) &_end_kernel_text
+         && va + size > (uint64_t) &start;
+}
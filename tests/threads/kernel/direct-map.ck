@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(direct-map) begin
+(direct-map) PASS
+(direct-map) end
+EOF
+pass;
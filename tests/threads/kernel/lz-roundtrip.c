@@ -0,0 +1,229 @@
+/* Checks lz_compress() and lz_decompress(), which zswap uses to
+   keep evicted pages in RAM.  Inputs of the kinds anonymous
+   memory holds, at many sizes, must come back unchanged, and
+   compressible ones must actually shrink.  Output that does not
+   fit must be refused rather than overrun its buffer, and
+   corrupt input must be refused, or at worst decompress to
+   garbage, without writing past the end of the output. */
+
+#include <lz.h>
+#include <random.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Largest input tried, in pages. */
+#define MAX_PAGES 4
+
+/* Bytes checked past the end of each output buffer. */
+#define GUARD_SIZE 64
+#define GUARD 0xe7
+
+enum pattern { ZEROS, SPARSE, RECORDS, RANDOM, PATTERN_CNT };
+static const char *pattern_names[PATTERN_CNT] = {
+  "zeros", "sparse", "records", "random"
+};
+
+static const size_t sizes[] = {
+  0, 1, 3, 4, 5, 14, 15, 16, 19, 20, 254, 255, 270, 271, 1000,
+  PGSIZE, 3 * PGSIZE + 7, MAX_PAGES * PGSIZE
+};
+
+static uint8_t *src, *out, *dst;
+static void *work;
+
+static void fill (uint8_t *, size_t, enum pattern);
+static void check_roundtrip (enum pattern, size_t size);
+static void check_bad_input (void);
+
+void
+test_lz_roundtrip (void)
+{
+  enum pattern p;
+  size_t i;
+
+  /* Compressed data may be a little larger than its input. */
+  src = palloc_get_multiple (PAL_ASSERT, MAX_PAGES);
+  out = palloc_get_multiple (PAL_ASSERT, MAX_PAGES + 1);
+  dst = palloc_get_multiple (PAL_ASSERT, MAX_PAGES + 1);
+  work = malloc (LZ_WORK_SIZE);
+  if (work == NULL)
+    fail ("out of memory");
+  random_init (0);
+
+  for (p = 0; p < PATTERN_CNT; p++)
+    for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+      check_roundtrip (p, sizes[i]);
+  check_bad_input ();
+
+  free (work);
+  palloc_free_multiple (dst, MAX_PAGES + 1);
+  palloc_free_multiple (out, MAX_PAGES + 1);
+  palloc_free_multiple (src, MAX_PAGES);
+  pass ();
+}
+
+/* Fails if any of the GUARD_SIZE bytes at P were written. */
+static void
+check_guard (const uint8_t *p, const char *what)
+{
+  size_t i;
+
+  for (i = 0; i < GUARD_SIZE; i++)
+    if (p[i] != GUARD)
+      fail ("%s wrote %zu bytes past the end of its output", what, i + 1);
+}
+
+/* Compresses SIZE bytes of pattern P, checks that exactly that
+   much room is enough and one byte less is not, and decompresses
+   the result into room of exactly SIZE bytes and into one byte
+   less. */
+static void
+check_roundtrip (enum pattern p, size_t size)
+{
+  const char *name = pattern_names[p];
+  size_t csize, result;
+
+  fill (src, size, p);
+  memset (out, GUARD, (MAX_PAGES + 1) * PGSIZE);
+  csize = lz_compress (src, size, out, (MAX_PAGES + 1) * PGSIZE, work);
+  if (csize == 0)
+    fail ("%zu bytes of %s did not compress", size, name);
+  if (p == ZEROS && size >= PGSIZE && csize > size / 64)
+    fail ("%zu bytes of zeros compressed to %zu bytes", size, csize);
+  if (p == RANDOM && size >= PGSIZE
+      && lz_compress (src, size, dst, size, work) != 0)
+    fail ("%zu random bytes compressed to fit in %zu bytes", size, size);
+
+  /* Exactly enough room, then one byte too few. */
+  memset (dst, GUARD, csize + GUARD_SIZE);
+  if (lz_compress (src, size, dst, csize, work) != csize
+      || memcmp (dst, out, csize))
+    fail ("compressing %zu bytes of %s into exactly %zu bytes failed",
+          size, name, csize);
+  check_guard (dst + csize, "lz_compress");
+  memset (dst, GUARD, csize + GUARD_SIZE);
+  if (lz_compress (src, size, dst, csize - 1, work) != 0)
+    fail ("compressing %zu bytes of %s into %zu bytes, too few, "
+          "did not fail", size, name, csize - 1);
+  check_guard (dst + csize - 1, "lz_compress");
+
+  memset (dst, GUARD, size + GUARD_SIZE);
+  result = lz_decompress (out, csize, dst, size);
+  if (result != size)
+    fail ("%zu bytes of %s decompressed to %zu bytes", size, name, result);
+  if (memcmp (src, dst, size))
+    fail ("%zu bytes of %s did not come back unchanged", size, name);
+  check_guard (dst + size, "lz_decompress");
+
+  if (size > 0)
+    {
+      memset (dst, GUARD, size + GUARD_SIZE);
+      if (lz_decompress (out, csize, dst, size - 1) != LZ_ERROR)
+        fail ("%zu bytes of %s decompressed into %zu bytes",
+              size, name, size - 1);
+      check_guard (dst + size - 1, "lz_decompress");
+    }
+}
+
+/* Decompresses the SIZE bytes at IN, which may be corrupt, into
+   room for CAPACITY bytes, and checks that it stays inside
+   them. */
+static size_t
+decompress_bad (const uint8_t *in, size_t size, size_t capacity)
+{
+  size_t result;
+
+  memset (dst, GUARD, capacity + GUARD_SIZE);
+  result = lz_decompress (in, size, dst, capacity);
+  if (result != LZ_ERROR && result > capacity)
+    fail ("lz_decompress returned %zu bytes into %zu", result, capacity);
+  check_guard (dst + capacity, "lz_decompress of corrupt input");
+  return result;
+}
+
+/* Feeds lz_decompress() input that lz_compress() could not have
+   produced. */
+static void
+check_bad_input (void)
+{
+  /* A match from before the start of the output, and one with
+     offset 0.  Each is one literal byte, then a 4-byte match. */
+  static const uint8_t too_far[] = { 0x10, 'a', 0x02, 0x00 };
+  static const uint8_t offset_0[] = { 0x10, 'a', 0x00, 0x00 };
+
+  /* A literal length that runs off the end of the input. */
+  static const uint8_t long_literals[] = { 0xf0, 255, 255 };
+
+  /* A match offset cut short. */
+  static const uint8_t short_offset[] = { 0x10, 'a', 0x01 };
+
+  size_t csize, cut;
+  int i;
+
+  if (decompress_bad (too_far, sizeof too_far, PGSIZE) != LZ_ERROR)
+    fail ("match from before the start of the output was accepted");
+  if (decompress_bad (offset_0, sizeof offset_0, PGSIZE) != LZ_ERROR)
+    fail ("match with offset 0 was accepted");
+  if (decompress_bad (long_literals, sizeof long_literals, PGSIZE)
+      != LZ_ERROR)
+    fail ("literals past the end of the input were accepted");
+  if (decompress_bad (short_offset, sizeof short_offset, PGSIZE)
+      != LZ_ERROR)
+    fail ("truncated match offset was accepted");
+
+  /* Every truncation of a real page, and random damage to it. */
+  fill (src, PGSIZE, RECORDS);
+  csize = lz_compress (src, PGSIZE, out, 2 * PGSIZE, work);
+  for (cut = 0; cut < csize; cut++)
+    decompress_bad (out, cut, PGSIZE);
+  for (i = 0; i < 500; i++)
+    {
+      size_t ofs = random_ulong () % csize;
+      uint8_t old = out[ofs];
+
+      out[ofs] ^= 1 + random_ulong () % 255;
+      decompress_bad (out, csize, PGSIZE);
+      out[ofs] = old;
+    }
+}
+
+/* Fills the SIZE bytes at BUF according to pattern P. */
+static void
+fill (uint8_t *buf, size_t size, enum pattern p)
+{
+  size_t i;
+
+  memset (buf, 0, size);
+  switch (p)
+    {
+    case ZEROS:
+      break;
+
+    case SPARSE:
+      /* A pointer-sized value every 128 bytes. */
+      for (i = 0; i + 8 <= size; i += 128)
+        *(uint64_t *) (buf + i) = random_ulong ();
+      break;
+
+    case RECORDS:
+      /* 32-byte records with a counter, a small tag and padding. */
+      for (i = 0; i + 32 <= size; i += 32)
+        {
+          *(uint32_t *) (buf + i) = i / 32;
+          buf[i + 4] = random_ulong () % 4;
+          memcpy (buf + i + 8, "record", 6);
+        }
+      break;
+
+    case RANDOM:
+      for (i = 0; i < size; i++)
+        buf[i] = random_ulong ();
+      break;
+
+    default:
+      NOT_REACHED ();
+    }
+}
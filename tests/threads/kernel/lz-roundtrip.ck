@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(lz-roundtrip) begin
+(lz-roundtrip) PASS
+(lz-roundtrip) end
+EOF
+pass;
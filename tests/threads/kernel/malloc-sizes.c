@@ -0,0 +1,224 @@
+/* Checks malloc(), calloc(), realloc() and free() at every size
+   up to past the largest size class, and for big blocks of
+   several pages.  Blocks must be aligned and must not overlap,
+   calloc() must zero blocks that were dirty when freed, and
+   realloc() must keep a block's contents as it moves between
+   size classes in either direction. */
+
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+
+/* Blocks live at once in check_sizes(). */
+#define BATCH 64
+
+/* Largest size tried byte by byte, past the largest class. */
+#define MAX_SMALL 3200
+
+/* Blocks of one size allocated at once in check_arenas(). */
+#define SAME_CNT 300
+
+static void check_sizes (void);
+static void check_arenas (void);
+static void check_big (void);
+static void check_calloc (void);
+static void check_realloc (void);
+
+void
+test_malloc_sizes (void)
+{
+  check_sizes ();
+  check_arenas ();
+  check_big ();
+  check_calloc ();
+  check_realloc ();
+  pass ();
+}
+
+/* Fills the SIZE bytes at P with a pattern that depends on
+   SEED. */
+static void
+tag (void *p, size_t size, unsigned seed)
+{
+  uint8_t *b = p;
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    b[i] = (uint8_t) (seed * 31 + i);
+}
+
+/* Fails unless the SIZE bytes at P hold what tag() put there for
+   SEED.  WHAT is for the failure message. */
+static void
+check_tag (const void *p, size_t size, unsigned seed, const char *what)
+{
+  const uint8_t *b = p;
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (b[i] != (uint8_t) (seed * 31 + i))
+      fail ("byte %zu of %zu-byte %s was overwritten", i, size, what);
+}
+
+/* Returns a new block of SIZE bytes, after checking its
+   alignment. */
+static void *
+checked_malloc (size_t size)
+{
+  void *p = malloc (size);
+
+  if (p == NULL)
+    fail ("malloc(%zu) failed", size);
+  if ((uintptr_t) p % sizeof (void *) != 0)
+    fail ("malloc(%zu) returned %p, which is not aligned", size, p);
+  return p;
+}
+
+/* Allocates blocks of every size from 1 byte to MAX_SMALL, BATCH
+   at a time, and checks that no block overwrote another. */
+static void
+check_sizes (void)
+{
+  void *blocks[BATCH];
+  size_t size, i;
+
+  for (size = 1; size <= MAX_SMALL; size += BATCH)
+    {
+      for (i = 0; i < BATCH; i++)
+        {
+          blocks[i] = checked_malloc (size + i);
+          tag (blocks[i], size + i, size + i);
+        }
+      for (i = 0; i < BATCH; i++)
+        {
+          check_tag (blocks[i], size + i, size + i, "block");
+          free (blocks[i]);
+        }
+    }
+}
+
+/* Allocates many blocks at each class boundary, more than fit
+   in one arena, frees every other one and allocates them again,
+   and checks that they all keep their contents. */
+static void
+check_arenas (void)
+{
+  static const size_t sizes[] = {
+    16, 17, 48, 49, 96, 192, 193, 384, 768, 1024, 1025, 1536, 1537, 3072,
+  };
+  static void *blocks[SAME_CNT];
+  size_t s, i;
+
+  for (s = 0; s < sizeof sizes / sizeof *sizes; s++)
+    {
+      size_t size = sizes[s];
+
+      for (i = 0; i < SAME_CNT; i++)
+        {
+          blocks[i] = checked_malloc (size);
+          tag (blocks[i], size, i);
+        }
+      for (i = 0; i < SAME_CNT; i += 2)
+        free (blocks[i]);
+      for (i = 0; i < SAME_CNT; i += 2)
+        {
+          blocks[i] = checked_malloc (size);
+          tag (blocks[i], size, i);
+        }
+      for (i = 0; i < SAME_CNT; i++)
+        {
+          check_tag (blocks[i], size, i, "block");
+          free (blocks[i]);
+        }
+    }
+}
+
+/* Allocates big blocks, which take whole pages, alongside small
+   ones. */
+static void
+check_big (void)
+{
+  static const size_t sizes[] = {
+    3073, PGSIZE - 64, PGSIZE, PGSIZE + 1, 3 * PGSIZE, 40 * PGSIZE + 5,
+  };
+  void *blocks[sizeof sizes / sizeof *sizes];
+  void *small = checked_malloc (100);
+  size_t i;
+
+  tag (small, 100, 99);
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    {
+      blocks[i] = checked_malloc (sizes[i]);
+      tag (blocks[i], sizes[i], i);
+    }
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    {
+      check_tag (blocks[i], sizes[i], i, "big block");
+      free (blocks[i]);
+    }
+  check_tag (small, 100, 99, "block");
+  free (small);
+}
+
+/* Dirties blocks of many sizes and frees them, then checks that
+   calloc() hands them out zeroed. */
+static void
+check_calloc (void)
+{
+  /* Volatile, so that the compiler does not see the overflow. */
+  volatile size_t huge = (size_t) 1 << 40;
+  void *blocks[BATCH];
+  size_t size, i, j;
+
+  for (size = 8; size <= 2 * PGSIZE; size *= 2)
+    {
+      for (i = 0; i < BATCH; i++)
+        memset (blocks[i] = checked_malloc (size), 0xff, size);
+      for (i = 0; i < BATCH; i++)
+        free (blocks[i]);
+      for (i = 0; i < BATCH; i++)
+        {
+          uint8_t *p = blocks[i] = calloc (size / 4, 4);
+
+          if (p == NULL)
+            fail ("calloc(%zu, 4) failed", size / 4);
+          for (j = 0; j < size; j++)
+            if (p[j] != 0)
+              fail ("byte %zu of calloc(%zu, 4) is %#x", j, size / 4, p[j]);
+        }
+      for (i = 0; i < BATCH; i++)
+        free (blocks[i]);
+    }
+
+  if (calloc (huge, huge) != NULL)
+    fail ("calloc() with an overflowing size succeeded");
+}
+
+/* Grows a block through every class and into a big block, then
+   shrinks it back, checking its contents at each step. */
+static void
+check_realloc (void)
+{
+  static const size_t sizes[] = {
+    1, 15, 16, 40, 64, 100, 200, 300, 600, 1000, 1500, 2500, 3072,
+    PGSIZE, 3 * PGSIZE + 1, 2 * PGSIZE, 3000, 700, 90, 8,
+  };
+  size_t i, old_size = 0;
+  void *p = NULL;
+
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    {
+      size_t size = sizes[i];
+      size_t kept = size < old_size ? size : old_size;
+
+      p = realloc (p, size);
+      if (p == NULL)
+        fail ("realloc() to %zu bytes failed", size);
+      check_tag (p, kept, 7, "block after realloc()");
+      tag (p, size, 7);
+      old_size = size;
+    }
+  if (realloc (p, 0) != NULL)
+    fail ("realloc() to 0 bytes did not return a null pointer");
+}
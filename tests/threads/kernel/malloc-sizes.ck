@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(malloc-sizes) begin
+(malloc-sizes) PASS
+(malloc-sizes) end
+EOF
+pass;
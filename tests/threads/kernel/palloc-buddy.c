@@ -0,0 +1,230 @@
+/* Checks the buddy page allocator.  Runs of many sizes must not
+   overlap, huge pages must be aligned to 2 MB, PAL_ZERO pages
+   must be zeroed however they are served, and once every page of
+   the user pool has been handed out and freed again, the free
+   blocks must merge back so that as large a run can be
+   allocated as before. */
+
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Pages of pointers to the user pool's pages, enough for 32 MB. */
+#define PTR_PAGES 16
+
+/* Largest run tried by check_runs(). */
+#define MAX_RUN 33
+
+/* Number of PAL_ZERO pages tried, more than the pools keep
+   zeroed in advance. */
+#define ZERO_CNT 200
+
+static void check_huge (void);
+static void check_runs (void);
+static void check_zero (void);
+static void check_merge (void);
+
+void
+test_palloc_buddy (void)
+{
+  check_huge ();
+  check_runs ();
+  check_zero ();
+  check_merge ();
+  pass ();
+}
+
+/* Fills each of the PAGE_CNT pages at PAGES with a byte that
+   depends on TAG and on the page. */
+static void
+tag_pages (void *pages, size_t page_cnt, size_t tag)
+{
+  size_t i;
+
+  for (i = 0; i < page_cnt; i++)
+    memset ((uint8_t *) pages + i * PGSIZE, (int) (tag + i), PGSIZE);
+}
+
+/* Fails unless the PAGE_CNT pages at PAGES still hold what
+   tag_pages() put there for TAG. */
+static void
+check_tag (void *pages, size_t page_cnt, size_t tag)
+{
+  size_t i, j;
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      uint8_t *p = (uint8_t *) pages + i * PGSIZE;
+
+      for (j = 0; j < PGSIZE; j++)
+        if (p[j] != (uint8_t) (tag + i))
+          fail ("byte %zu of page %zu of run %zu was overwritten",
+                j, i, tag);
+    }
+}
+
+/* Allocates a huge page from each pool and checks its
+   alignment. */
+static void
+check_huge (void)
+{
+  static const enum palloc_flags pools[] = { 0, PAL_USER };
+  size_t i;
+
+  for (i = 0; i < sizeof pools / sizeof *pools; i++)
+    {
+      uint8_t *p = palloc_get_huge (pools[i] | PAL_ZERO);
+      size_t j;
+
+      if (p == NULL)
+        {
+          /* The kernel pool may well be too fragmented by now. */
+          if (pools[i] & PAL_USER)
+            fail ("no huge page in the user pool");
+          continue;
+        }
+      if (vtop (p) % LARGE_PGSIZE != 0)
+        fail ("huge page at %p is not aligned to 2 MB", (void *) vtop (p));
+      for (j = 0; j < LARGE_PGSIZE; j++)
+        if (p[j] != 0)
+          fail ("byte %zu of a zeroed huge page is %#x", j, p[j]);
+      tag_pages (p, LARGE_PGSIZE / PGSIZE, 1);
+      check_tag (p, LARGE_PGSIZE / PGSIZE, 1);
+      palloc_free_multiple (p, LARGE_PGSIZE / PGSIZE);
+    }
+}
+
+/* Allocates runs of every size up to MAX_RUN pages from both
+   pools, tags every page, and checks that no run overwrote
+   another.  Frees every other run first, then the rest, so that
+   the frees merge in both directions. */
+static void
+check_runs (void)
+{
+  void *runs[2][MAX_RUN + 1];
+  size_t cnt;
+  size_t round;
+  int pool;
+
+  for (pool = 0; pool < 2; pool++)
+    for (cnt = 1; cnt <= MAX_RUN; cnt++)
+      {
+        runs[pool][cnt] = palloc_get_multiple (pool ? PAL_USER : 0, cnt);
+        if (runs[pool][cnt] == NULL)
+          fail ("allocating %zu pages from the %s pool failed",
+                cnt, pool ? "user" : "kernel");
+        if (pg_ofs (runs[pool][cnt]) != 0)
+          fail ("run of %zu pages at %p is not page-aligned",
+                cnt, runs[pool][cnt]);
+        tag_pages (runs[pool][cnt], cnt, pool * 64 + cnt);
+      }
+
+  for (round = 0; round < 2; round++)
+    for (pool = 0; pool < 2; pool++)
+      for (cnt = 1; cnt <= MAX_RUN; cnt++)
+        if (cnt % 2 == round)
+          {
+            check_tag (runs[pool][cnt], cnt, pool * 64 + cnt);
+            palloc_free_multiple (runs[pool][cnt], cnt);
+          }
+}
+
+/* Dirties pages and frees them, then checks that PAL_ZERO
+   allocations come back zeroed, first single pages, which may
+   come from the pages zeroed in advance, then runs. */
+static void
+check_zero (void)
+{
+  static uint8_t *pages[ZERO_CNT];
+  size_t i, j;
+
+  for (i = 0; i < ZERO_CNT; i++)
+    {
+      pages[i] = palloc_get_page (PAL_USER | PAL_ASSERT);
+      memset (pages[i], 0x5a, PGSIZE);
+    }
+  for (i = 0; i < ZERO_CNT; i++)
+    palloc_free_page (pages[i]);
+
+  for (i = 0; i < ZERO_CNT; i++)
+    {
+      pages[i] = palloc_get_page (PAL_USER | PAL_ZERO | PAL_ASSERT);
+      for (j = 0; j < PGSIZE; j++)
+        if (pages[i][j] != 0)
+          fail ("byte %zu of zeroed page %zu is %#x", j, i, pages[i][j]);
+    }
+  for (i = 0; i < ZERO_CNT; i++)
+    palloc_free_page (pages[i]);
+
+  for (i = 2; i <= 16; i++)
+    {
+      uint8_t *p = palloc_get_multiple (PAL_USER | PAL_ZERO | PAL_ASSERT, i);
+
+      for (j = 0; j < i * PGSIZE; j++)
+        if (p[j] != 0)
+          fail ("byte %zu of a zeroed run of %zu pages is %#x", j, i, p[j]);
+      memset (p, 0x5a, i * PGSIZE);
+      palloc_free_multiple (p, i);
+    }
+}
+
+/* Returns the largest power of two N such that N contiguous user
+   pages can be allocated. */
+static size_t
+largest_run (void)
+{
+  size_t cnt;
+
+  for (cnt = (size_t) 1 << 20; cnt > 1; cnt /= 2)
+    {
+      void *p = palloc_get_multiple (PAL_USER, cnt);
+      if (p != NULL)
+        {
+          palloc_free_multiple (p, cnt);
+          break;
+        }
+    }
+  return cnt;
+}
+
+/* Allocates every page in the user pool one at a time, checks
+   that they are all distinct, and frees every other one before
+   the rest, so that most frees find their buddy still allocated.
+   The pool must then merge its free blocks back together. */
+static void
+check_merge (void)
+{
+  size_t cap = PTR_PAGES * PGSIZE / sizeof (void *);
+  size_t before = largest_run (), after;
+  void **pages = palloc_get_multiple (PAL_ASSERT, PTR_PAGES);
+  size_t cnt, i;
+
+  for (cnt = 0; cnt < cap; cnt++)
+    {
+      pages[cnt] = palloc_get_page (PAL_USER);
+      if (pages[cnt] == NULL)
+        break;
+      *(size_t *) pages[cnt] = cnt;
+    }
+  if (cnt == cap)
+    fail ("user pool has more than %zu pages", cap);
+  if (palloc_get_multiple (PAL_USER, 2) != NULL)
+    fail ("allocated 2 pages from an exhausted user pool");
+
+  for (i = 0; i < cnt; i++)
+    if (*(size_t *) pages[i] != i)
+      fail ("user page %zu was handed out twice", i);
+
+  for (i = 0; i < cnt; i += 2)
+    palloc_free_page (pages[i]);
+  for (i = 1; i < cnt; i += 2)
+    palloc_free_page (pages[i]);
+  palloc_free_multiple (pages, PTR_PAGES);
+
+  after = largest_run ();
+  if (after < before)
+    fail ("largest run of user pages shrank from %zu to %zu pages "
+          "after freeing every page", before, after);
+}
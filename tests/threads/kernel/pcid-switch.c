@@ -0,0 +1,153 @@
+/* Checks that tagging address spaces with PCIDs never lets one
+   address space see another's TLB entries, or its own stale ones.
+
+   Many more address spaces than there are PCIDs map the same
+   user addresses to pages of their own, and take turns running.
+   Each turn reads every page and checks that it holds what the
+   running space mapped there.  Between turns, mappings change in
+   spaces that are not running and in the one that is, and
+   address spaces are destroyed and created again, which recycles
+   both PCIDs and the pages the page map level 4s live in.  On a
+   CPU without PCIDs, every switch flushes the TLB, and the test
+   should pass all the same. */
+
+#include "tests/threads/tests.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Address spaces, more than twice the PCIDs a CPU hands out. */
+#define SPACE_CNT 40
+
+/* Pages mapped in each. */
+#define PAGE_CNT 4
+
+/* Where the test maps its pages. */
+#define UBASE ((uint8_t *) 0x10000000)
+
+static uint64_t *spaces[SPACE_CNT];
+static int *frames[SPACE_CNT][PAGE_CNT];
+
+static void space_create (int space, int gen);
+static void run_all (const char *when);
+static void check_space (int space, const char *when);
+
+void
+test_pcid_switch (void)
+{
+  enum intr_level old_level;
+  int i;
+
+  for (i = 0; i < SPACE_CNT; i++)
+    space_create (i, 0);
+  run_all ("at first");
+  run_all ("on the second round");
+
+  /* Swap the first two pages of every other space while it is
+     not running.  Its PCID's entries must not survive. */
+  for (i = 0; i < SPACE_CNT; i += 2)
+    {
+      int *tmp = frames[i][0];
+
+      frames[i][0] = frames[i][1];
+      frames[i][1] = tmp;
+      if (!pml4_set_page (spaces[i], UBASE, frames[i][0], true)
+          || !pml4_set_page (spaces[i], UBASE + PGSIZE, frames[i][1], true))
+        fail ("remapping pages of space %d failed", i);
+    }
+  run_all ("after remapping inactive spaces");
+
+  /* Swap them back in each space while it is running, after
+     reading them, so that the old translations are cached. */
+  for (i = 0; i < SPACE_CNT; i += 2)
+    {
+      int *tmp = frames[i][0];
+
+      old_level = intr_disable ();
+      pml4_activate (spaces[i]);
+      check_space (i, "before remapping it while active");
+      frames[i][0] = frames[i][1];
+      frames[i][1] = tmp;
+      if (!pml4_set_page (spaces[i], UBASE, frames[i][0], true)
+          || !pml4_set_page (spaces[i], UBASE + PGSIZE, frames[i][1], true))
+        fail ("remapping pages of space %d failed", i);
+      check_space (i, "after remapping it while active");
+      pml4_activate (NULL);
+      intr_set_level (old_level);
+    }
+  run_all ("after remapping active spaces");
+
+  /* Replace every third space by a new one.  A new page map level
+     4 may well take the page of the one just freed. */
+  for (i = 0; i < SPACE_CNT; i += 3)
+    {
+      pml4_destroy (spaces[i]);
+      space_create (i, 1);
+    }
+  run_all ("after recycling spaces");
+
+  for (i = 0; i < SPACE_CNT; i++)
+    pml4_destroy (spaces[i]);
+  pass ();
+}
+
+/* Creates address space SPACE, with PAGE_CNT pages mapped at
+   UBASE.  Each page starts with a number that tells it apart
+   from the pages of every other space and of generation GEN. */
+static void
+space_create (int space, int gen)
+{
+  int i;
+
+  spaces[space] = pml4_create ();
+  if (spaces[space] == NULL)
+    fail ("creating address space %d failed", space);
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      int *page = palloc_get_page (PAL_USER | PAL_ASSERT);
+
+      *page = (gen * SPACE_CNT + space) * PAGE_CNT + i;
+      frames[space][i] = page;
+      if (!pml4_set_page (spaces[space], UBASE + i * PGSIZE, page, true))
+        fail ("mapping page %d of address space %d failed", i, space);
+    }
+}
+
+/* Runs every address space in turn, and checks what it sees.
+   Then runs the first two again, interleaved, as a scheduler
+   would between two busy processes.  WHEN says when in the test
+   this happens. */
+static void
+run_all (const char *when)
+{
+  enum intr_level old_level = intr_disable ();
+  int i;
+
+  for (i = 0; i < SPACE_CNT + 8; i++)
+    {
+      int space = i < SPACE_CNT ? i : i % 2;
+
+      pml4_activate (spaces[space]);
+      check_space (space, when);
+    }
+  pml4_activate (NULL);
+  intr_set_level (old_level);
+}
+
+/* Checks that the pages at UBASE in the running address space
+   are those SPACE mapped.  WHEN is for the failure message. */
+static void
+check_space (int space, const char *when)
+{
+  int i;
+
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      volatile int *p = (int *) (UBASE + i * PGSIZE);
+
+      if (*p != *frames[space][i])
+        fail ("page %d of address space %d holds %d, not %d, %s",
+              i, space, *p, *frames[space][i], when);
+    }
+}
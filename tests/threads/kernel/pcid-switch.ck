@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pcid-switch) begin
+(pcid-switch) PASS
+(pcid-switch) end
+EOF
+pass;
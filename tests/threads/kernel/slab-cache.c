@@ -0,0 +1,183 @@
+/* Checks the slab allocator.  Caches of objects of many sizes
+   and alignments hand out several slabs' worth of objects, which
+   must be aligned, must not overlap, and must survive the
+   freeing and reallocation of their neighbours.  A cache with a
+   constructor must hand out only constructed objects, and must
+   not construct an object again when it is reused. */
+
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/slab.h"
+#include "threads/vaddr.h"
+
+/* Most objects allocated from one cache at once. */
+#define MAX_OBJS 1600
+
+struct cache_shape
+  {
+    size_t size;
+    size_t align;
+  };
+
+static const struct cache_shape shapes[] = {
+  { 1, 0 }, { 24, 0 }, { 100, 0 }, { 560, 0 }, { 1024, 0 },
+  { 64, 64 }, { 200, 128 }, { 8, 256 },
+};
+
+static void *objs[MAX_OBJS];
+
+static void check_shape (const struct cache_shape *);
+static void check_ctor (void);
+
+void
+test_slab_cache (void)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof shapes / sizeof *shapes; i++)
+    check_shape (&shapes[i]);
+  check_ctor ();
+  pass ();
+}
+
+/* Fills the SIZE bytes of object IDX with a byte that depends
+   on IDX. */
+static void
+tag (size_t idx, size_t size)
+{
+  memset (objs[idx], (int) (idx * 7 + 1), size);
+}
+
+/* Fails unless the SIZE bytes of object IDX still hold what tag()
+   put there. */
+static void
+check_tag (size_t idx, size_t size)
+{
+  const uint8_t *p = objs[idx];
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (p[i] != (uint8_t) (idx * 7 + 1))
+      fail ("byte %zu of %zu-byte object %zu was overwritten",
+            i, size, idx);
+}
+
+/* Allocates about three slabs' worth of objects of SHAPE, checks
+   them, frees every other one, allocates as many again, and
+   checks them all once more. */
+static void
+check_shape (const struct cache_shape *shape)
+{
+  struct kmem_cache *c = kmem_cache_create ("test", shape->size,
+                                            shape->align, NULL);
+  size_t align = shape->align ? shape->align : sizeof (void *);
+  size_t size = shape->size;
+  size_t cnt = 3 * PGSIZE / (size < align ? align : size) + 5;
+  size_t i;
+
+  if (cnt > MAX_OBJS)
+    cnt = MAX_OBJS;
+  for (i = 0; i < cnt; i++)
+    {
+      objs[i] = kmem_cache_alloc (c);
+      if (objs[i] == NULL)
+        fail ("allocating %zu-byte object %zu failed", size, i);
+      if ((uintptr_t) objs[i] % align != 0)
+        fail ("%zu-byte object %zu at %p is not aligned on %zu bytes",
+              size, i, objs[i], align);
+      if (pg_ofs (objs[i]) + size > PGSIZE)
+        fail ("%zu-byte object %zu at %p crosses a page boundary",
+              size, i, objs[i]);
+      tag (i, size);
+    }
+  for (i = 0; i < cnt; i++)
+    check_tag (i, size);
+
+  for (i = 0; i < cnt; i += 2)
+    kmem_cache_free (c, objs[i]);
+  for (i = 0; i < cnt; i += 2)
+    {
+      objs[i] = kmem_cache_alloc (c);
+      if (objs[i] == NULL)
+        fail ("reallocating %zu-byte object %zu failed", size, i);
+      tag (i, size);
+    }
+  for (i = 0; i < cnt; i++)
+    check_tag (i, size);
+
+  for (i = 0; i < cnt; i++)
+    kmem_cache_free (c, objs[i]);
+}
+
+/* An object with a constructor. */
+struct ctor_obj
+  {
+    unsigned magic;             /* CTOR_MAGIC once constructed. */
+    char data[40];              /* Scratch space, left zeroed. */
+  };
+
+#define CTOR_MAGIC 0x0b1ec7ed
+
+static unsigned ctor_cnt;
+
+static void
+ctor (void *obj_)
+{
+  struct ctor_obj *obj = obj_;
+
+  obj->magic = CTOR_MAGIC;
+  ctor_cnt++;
+  memset (obj->data, 0, sizeof obj->data);
+}
+
+/* Checks that objects come out constructed, and that freeing and
+   reallocating an object does not construct it again. */
+static void
+check_ctor (void)
+{
+  struct kmem_cache *c = kmem_cache_create ("test-ctor",
+                                            sizeof (struct ctor_obj), 0,
+                                            ctor);
+  size_t cnt = 3 * PGSIZE / sizeof (struct ctor_obj);
+  unsigned constructed;
+  size_t i, j;
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct ctor_obj *obj = objs[i] = kmem_cache_alloc (c);
+
+      if (obj == NULL)
+        fail ("allocating constructed object %zu failed", i);
+      if (obj->magic != CTOR_MAGIC)
+        fail ("object %zu was not constructed", i);
+      for (j = 0; j < sizeof obj->data; j++)
+        if (obj->data[j] != 0)
+          fail ("object %zu came out in a changed state", i);
+
+      /* Use the object, then put it back the way it was. */
+      memset (obj->data, 'x', sizeof obj->data);
+      memset (obj->data, 0, sizeof obj->data);
+    }
+  if (ctor_cnt < cnt)
+    fail ("%zu objects were handed out, but only %u constructed",
+          cnt, ctor_cnt);
+
+  /* Free every other object, so that no slab empties out and
+     goes back to the page allocator, and allocate as many again.
+     They must all be reused as they are. */
+  constructed = ctor_cnt;
+  for (i = 0; i < cnt; i += 2)
+    kmem_cache_free (c, objs[i]);
+  for (i = 0; i < cnt; i += 2)
+    {
+      struct ctor_obj *obj = objs[i] = kmem_cache_alloc (c);
+
+      if (obj == NULL || obj->magic != CTOR_MAGIC)
+        fail ("reallocated object %zu is not constructed", i);
+    }
+  if (ctor_cnt != constructed)
+    fail ("%u objects were constructed again on reuse",
+          ctor_cnt - constructed);
+  for (i = 0; i < cnt; i++)
+    kmem_cache_free (c, objs[i]);
+}
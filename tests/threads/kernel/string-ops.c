@@ -0,0 +1,212 @@
+/* Checks memcpy(), memmove(), memset(), memcmp() and strlen()
+   against byte-at-a-time loops.  The library versions work a
+   word at a time in the middle of a buffer and a byte at a time
+   at its ends, so every combination of unaligned head, length
+   and tail is tried, as are overlapping moves in both directions
+   and a difference at every byte position for memcmp(). */
+
+#include <stdint.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+
+/* Longest length tried.  Covers several whole words plus every
+   possible tail. */
+#define MAX_LEN 72
+
+/* Largest misalignment tried at either end. */
+#define MAX_OFS 16
+
+/* Space for a buffer, with room for misalignment and guard
+   bytes on both sides. */
+#define BUF_SIZE (MAX_LEN + 3 * MAX_OFS)
+
+#define GUARD 0xa5
+
+static unsigned char src[BUF_SIZE], dst[BUF_SIZE], ref[BUF_SIZE];
+
+static void check_memcpy (void);
+static void check_memset (void);
+static void check_memmove (void);
+static void check_memcmp (void);
+static void check_strlen (void);
+
+void
+test_string_ops (void)
+{
+  check_memcpy ();
+  check_memset ();
+  check_memmove ();
+  check_memcmp ();
+  check_strlen ();
+  pass ();
+}
+
+/* Fills the SIZE bytes at P with a pattern that differs from
+   byte to byte and depends on SEED. */
+static void
+fill (unsigned char *p, size_t size, unsigned seed)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    p[i] = (unsigned char) (i * 7 + seed * 13 + 1);
+}
+
+/* Fails unless DST matches REF everywhere. */
+static void
+compare (const char *what, size_t ofs, size_t ofs2, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < BUF_SIZE; i++)
+    if (dst[i] != ref[i])
+      fail ("%s (offsets %zu, %zu, length %zu): byte %zu is %#x, not %#x",
+            what, ofs, ofs2, len, i, dst[i], ref[i]);
+}
+
+static void
+check_memcpy (void)
+{
+  size_t sofs, dofs, len, i;
+
+  fill (src, BUF_SIZE, 1);
+  for (sofs = 0; sofs < MAX_OFS; sofs++)
+    for (dofs = 0; dofs < MAX_OFS; dofs++)
+      for (len = 0; len <= MAX_LEN; len++)
+        {
+          memset (dst, GUARD, BUF_SIZE);
+          memset (ref, GUARD, BUF_SIZE);
+          for (i = 0; i < len; i++)
+            ref[MAX_OFS + dofs + i] = src[sofs + i];
+
+          if (memcpy (dst + MAX_OFS + dofs, src + sofs, len)
+              != dst + MAX_OFS + dofs)
+            fail ("memcpy did not return its destination");
+          compare ("memcpy", sofs, dofs, len);
+        }
+}
+
+static void
+check_memset (void)
+{
+  size_t ofs, len, i;
+
+  for (ofs = 0; ofs < MAX_OFS; ofs++)
+    for (len = 0; len <= MAX_LEN; len++)
+      {
+        int value = 0x100 + len;
+
+        /* Start from nonzero bytes, so that zeroing shows. */
+        fill (dst, BUF_SIZE, len);
+        memcpy (ref, dst, BUF_SIZE);
+        for (i = 0; i < len; i++)
+          ref[MAX_OFS + ofs + i] = (unsigned char) value;
+
+        if (memset (dst + MAX_OFS + ofs, value, len) != dst + MAX_OFS + ofs)
+          fail ("memset did not return its destination");
+        compare ("memset", ofs, 0, len);
+      }
+}
+
+/* Tries every overlapping move, to lower and to higher
+   addresses, along with moves that just miss overlapping. */
+static void
+check_memmove (void)
+{
+  size_t ofs, len, i;
+  int shift;
+
+  for (ofs = 0; ofs < MAX_OFS; ofs++)
+    for (len = 0; len <= MAX_LEN; len++)
+      for (shift = -MAX_OFS; shift <= MAX_OFS; shift++)
+        {
+          unsigned char *from = dst + MAX_OFS + ofs;
+          unsigned char *to = from + shift;
+
+          fill (dst, BUF_SIZE, ofs + len);
+          memcpy (ref, dst, BUF_SIZE);
+          memcpy (src, from, len);
+          for (i = 0; i < len; i++)
+            ref[MAX_OFS + ofs + shift + i] = src[i];
+
+          if (memmove (to, from, len) != to)
+            fail ("memmove did not return its destination");
+          compare ("memmove", ofs, shift + MAX_OFS, len);
+        }
+}
+
+/* Returns -1, 0 or 1 for the sign of X. */
+static int
+sign (int x)
+{
+  return (x > 0) - (x < 0);
+}
+
+/* Makes the buffers differ at every position of every length,
+   one way and the other, with bytes that compare differently as
+   signed and as unsigned chars.  Bytes past the first
+   difference differ the other way, so that they must not count. */
+static void
+check_memcmp (void)
+{
+  size_t ofs, len, pos, i;
+
+  for (ofs = 0; ofs < MAX_OFS; ofs++)
+    for (len = 0; len <= MAX_LEN; len++)
+      {
+        unsigned char *a = src + ofs;
+        unsigned char *b = dst + MAX_OFS - ofs;
+
+        fill (a, len, len);
+        memcpy (b, a, len);
+        if (memcmp (a, b, len) != 0)
+          fail ("memcmp of equal blocks (offset %zu, length %zu) "
+                "is not 0", ofs, len);
+
+        for (pos = 0; pos < len; pos++)
+          {
+            fill (a, len, len);
+            memcpy (b, a, len);
+            a[pos] = 0x80;
+            b[pos] = 0x7f;
+            for (i = pos + 1; i < len; i++)
+              {
+                a[i] = 0x00;
+                b[i] = 0xff;
+              }
+
+            if (sign (memcmp (a, b, len)) != 1)
+              fail ("memcmp (offset %zu, length %zu) missed that the first "
+                    "block is greater at byte %zu", ofs, len, pos);
+            if (sign (memcmp (b, a, len)) != -1)
+              fail ("memcmp (offset %zu, length %zu) missed that the first "
+                    "block is less at byte %zu", ofs, len, pos);
+            if (memcmp (a, b, pos) != 0)
+              fail ("memcmp (offset %zu) looked past its length %zu",
+                    ofs, pos);
+          }
+      }
+}
+
+/* Tries every length at every alignment, with bytes that have
+   their high bit set before the null terminator, and data that
+   is not zero after it. */
+static void
+check_strlen (void)
+{
+  size_t ofs, len, i;
+
+  for (ofs = 0; ofs < MAX_OFS; ofs++)
+    for (len = 0; len <= MAX_LEN; len++)
+      {
+        char *s = (char *) dst + ofs;
+
+        for (i = 0; i < BUF_SIZE - ofs; i++)
+          s[i] = i % 2 ? 'a' : (char) 0x80;
+        s[len] = '\0';
+
+        if (strlen (s) != len)
+          fail ("strlen (offset %zu) returned %zu, not %zu",
+                ofs, strlen (s), len);
+      }
+}
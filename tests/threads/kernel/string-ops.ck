@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(string-ops) begin
+(string-ops) PASS
+(string-ops) end
+EOF
+pass;
@@ -0,0 +1,76 @@
+/* Measures the cost of touching many pages through the kernel's
+   direct map, which uses 2 MB pages, against touching as many
+   pages mapped with 4 kB pages by vmalloc().
+
+   Each pass reads one byte from every page of a 16 MB buffer in
+   a scattered order, so that the 4 kB mappings overflow the TLB
+   while the 2 MB ones need only eight entries.  It is a
+   benchmark, not a graded test: the numbers vary from machine
+   to machine. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "threads/vmalloc.h"
+#include "intrinsic.h"
+
+#define PAGE_CNT 4096
+#define PASS_CNT 8
+
+/* Pages skipped between touches.  Odd, so every page is
+   visited once per pass. */
+#define PAGE_STRIDE 97
+
+static uint64_t touch (const uint8_t *buf);
+
+void
+test_tlb_bench (void)
+{
+  uint8_t *direct, *mapped;
+
+  direct = palloc_get_multiple (0, PAGE_CNT);
+  mapped = vmalloc (0, PAGE_CNT);
+  if (direct == NULL || mapped == NULL)
+    {
+      msg ("could not allocate two %d-page buffers", PAGE_CNT);
+      if (direct != NULL)
+        palloc_free_multiple (direct, PAGE_CNT);
+      if (mapped != NULL)
+        vfree (mapped, PAGE_CNT);
+      pass ();
+      return;
+    }
+
+  msg ("2 MB pages (direct map): %llu cycles per touch", touch (direct));
+  msg ("4 kB pages (vmalloc): %llu cycles per touch", touch (mapped));
+
+  vfree (mapped, PAGE_CNT);
+  palloc_free_multiple (direct, PAGE_CNT);
+  pass ();
+}
+
+/* Returns the mean cycles per page touched in BUF over PASS_CNT
+   passes, after one untimed pass to warm up the caches. */
+static uint64_t
+touch (const uint8_t *buf)
+{
+  volatile const uint8_t *p = buf;
+  uint64_t start = 0;
+  size_t page = 0;
+  int pass, i;
+
+  for (pass = 0; pass <= PASS_CNT; pass++)
+    {
+      if (pass == 1)
+        start = rdtsc ();
+      for (i = 0; i < PAGE_CNT; i++)
+        {
+          /* Vary the offset within the page so that the bytes
+             touched do not all fall into the same cache set. */
+          (void) p[page * PGSIZE + (page * 64) % PGSIZE];
+          page = (page + PAGE_STRIDE) % PAGE_CNT;
+        }
+    }
+  return (rdtsc () - start) / (PASS_CNT * PAGE_CNT);
+}
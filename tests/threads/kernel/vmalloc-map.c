@@ -0,0 +1,121 @@
+/* Checks vmalloc() and vfree().  Allocations of several sizes
+   must lie in the vmalloc range, be backed by distinct physical
+   pages mapped globally, and be followed by an unmapped guard
+   page.  Mappings made after an address space was created must
+   show up in it too.  vfree() must remove the mappings. */
+
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/mmu.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+#include "threads/vmalloc.h"
+
+static const size_t sizes[] = { 1, 2, 3, 17, 64, 300 };
+#define SIZE_CNT (sizeof sizes / sizeof *sizes)
+
+/* Physical addresses of all the pages allocated at once. */
+#define MAX_FRAMES 400
+static uint64_t frames[MAX_FRAMES];
+static size_t frame_cnt;
+
+static uint64_t *lookup (uint64_t *pml4, const void *va);
+static void check_mapped (uint8_t *pages, size_t page_cnt, uint64_t *pml4);
+
+void
+test_vmalloc_map (void)
+{
+  uint8_t *blocks[SIZE_CNT];
+  uint64_t *pml4 = pml4_create ();
+  size_t i, j;
+
+  if (pml4 == NULL)
+    fail ("out of memory");
+  for (i = 0; i < SIZE_CNT; i++)
+    {
+      blocks[i] = vmalloc (i % 2 ? PAL_ZERO : 0, sizes[i]);
+      if (blocks[i] == NULL)
+        fail ("vmalloc of %zu pages failed", sizes[i]);
+      if (i % 2)
+        for (j = 0; j < sizes[i] * PGSIZE; j++)
+          if (blocks[i][j] != 0)
+            fail ("byte %zu of %zu zeroed pages is %#x",
+                  j, sizes[i], blocks[i][j]);
+      check_mapped (blocks[i], sizes[i], pml4);
+      memset (blocks[i], (int) i + 1, sizes[i] * PGSIZE);
+    }
+
+  /* Each allocation still holds what was written to it. */
+  for (i = 0; i < SIZE_CNT; i++)
+    for (j = 0; j < sizes[i] * PGSIZE; j++)
+      if (blocks[i][j] != i + 1)
+        fail ("byte %zu of %zu pages was overwritten", j, sizes[i]);
+
+  for (i = 0; i < SIZE_CNT; i++)
+    {
+      vfree (blocks[i], sizes[i]);
+      for (j = 0; j < sizes[i]; j++)
+        if (lookup (base_pml4, blocks[i] + j * PGSIZE) != NULL)
+          fail ("page %zu of %zu is still mapped after vfree",
+                j, sizes[i]);
+    }
+  pml4_destroy (pml4);
+  pass ();
+}
+
+/* Returns the present page table entry for VA in PML4, or a null
+   pointer if there is none. */
+static uint64_t *
+lookup (uint64_t *pml4, const void *va)
+{
+  uint64_t *pte = pml4e_walk (pml4, (uint64_t) va, 0);
+
+  return pte != NULL && (*pte & PTE_P) ? pte : NULL;
+}
+
+/* Checks the mappings of the PAGE_CNT pages at PAGES, just
+   allocated with vmalloc(), in base_pml4 and in PML4, which was
+   created before them. */
+static void
+check_mapped (uint8_t *pages, size_t page_cnt, uint64_t *pml4)
+{
+  uint8_t *end = pages + page_cnt * PGSIZE;
+  size_t i, j;
+
+  if (!is_vmalloc_vaddr (pages) || !is_vmalloc_vaddr (end - 1))
+    fail ("%zu pages at %p are outside the vmalloc range", page_cnt, pages);
+  if (pg_ofs (pages) != 0)
+    fail ("%zu pages at %p are not page-aligned", page_cnt, pages);
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      uint8_t *va = pages + i * PGSIZE;
+      uint64_t *pte = lookup (base_pml4, va);
+      uint64_t pa;
+
+      if (pte == NULL)
+        fail ("page %zu of %zu at %p is not mapped", i, page_cnt, va);
+      if (!(*pte & PTE_G) || !(*pte & PTE_W) || (*pte & PTE_U))
+        fail ("page %zu of %zu is mapped with flags %#llx",
+              i, page_cnt, *pte & 0xfff);
+      if (lookup (pml4, va) != pte)
+        fail ("page %zu of %zu is not mapped in another address space "
+              "through the same page table", i, page_cnt);
+
+      /* The page seen through the direct map is the same one. */
+      pa = PTE_ADDR (*pte);
+      va[0] = 0x5a;
+      if (*(uint8_t *) ptov (pa) != 0x5a)
+        fail ("page %zu of %zu is not backed by %#llx", i, page_cnt, pa);
+
+      for (j = 0; j < frame_cnt; j++)
+        if (frames[j] == pa)
+          fail ("page %zu of %zu shares its frame with another", i, page_cnt);
+      if (frame_cnt < MAX_FRAMES)
+        frames[frame_cnt++] = pa;
+    }
+
+  if (lookup (base_pml4, end) != NULL)
+    fail ("the guard page after %zu pages at %p is mapped", page_cnt, pages);
+}
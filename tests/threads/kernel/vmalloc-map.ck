@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(vmalloc-map) begin
+(vmalloc-map) PASS
+(vmalloc-map) end
+EOF
+pass;
@@ -38,6 +38,25 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"string-ops", test_string_ops},
+    {"bitmap-ops", test_bitmap_ops},
+    {"palloc-buddy", test_palloc_buddy},
+    {"direct-map", test_direct_map},
+    {"pcid-switch", test_pcid_switch},
+    {"lz-roundtrip", test_lz_roundtrip},
+    {"slab-cache", test_slab_cache},
+    {"malloc-sizes", test_malloc_sizes},
+    {"vmalloc-map", test_vmalloc_map},
+    {"palloc-bench", test_palloc_bench},
+    {"tlb-bench", test_tlb_bench},
+    {"pcid-bench", test_pcid_bench},
+#ifdef VM
+    {"vma-tree", test_vma_tree},
+    {"evict-policy", test_evict_policy},
+    {"zswap-pool", test_zswap_pool},
+    {"ksm-merge", test_ksm_merge},
+    {"ksm-scan", test_ksm_scan},
+#endif
   };
 
 static const char *test_name;
@@ -32,6 +32,25 @@ extern test_func test_mlfqs_fair_20;
 extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
+extern test_func test_string_ops;
+extern test_func test_bitmap_ops;
+extern test_func test_palloc_buddy;
+extern test_func test_direct_map;
+extern test_func test_pcid_switch;
+extern test_func test_lz_roundtrip;
+extern test_func test_slab_cache;
+extern test_func test_malloc_sizes;
+extern test_func test_vmalloc_map;
+extern test_func test_palloc_bench;
+extern test_func test_tlb_bench;
+extern test_func test_pcid_bench;
+#ifdef VM
+extern test_func test_vma_tree;
+extern test_func test_evict_policy;
+extern test_func test_zswap_pool;
+extern test_func test_ksm_merge;
+extern test_func test_ksm_scan;
+#endif
 
 void msg (const char *, ...);
 void fail (const char *, ...);
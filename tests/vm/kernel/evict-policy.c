@@ -0,0 +1,312 @@
+/* Checks the page replacement policies of vm/evict.c.  The test
+   runs each policy over frames and pages of its own, mapped in an
+   address space whose accessed and dirty bits it sets itself, the
+   way the CPU would on each access.
+
+   Every policy must hand back each frame it holds exactly once,
+   and none that was taken out of it.  FIFO must evict in the
+   order pages came in, and clock must pass over pages that were
+   accessed or are dirty.  Under a loop over a few hot pages mixed
+   with a scan of pages used only once, clock, 2Q and ARC must
+   keep the hot pages resident.
+
+   No user process runs, so the policy in use holds no frames and
+   may be started over. */
+
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/evict.h"
+#include "vm/vm.h"
+
+/* Frames the pages compete for. */
+#define FRAME_CNT 16
+
+/* Pages, which all map the same physical page. */
+#define PAGE_CNT 512
+
+/* Hot pages in the scan workload, touched every round. */
+#define HOT_CNT 8
+
+/* Pages of the scan touched in each round. */
+#define SCAN_STEP 4
+
+/* Rounds of the scan workload, and those that warm it up. */
+#define ROUND_CNT 120
+#define WARMUP_CNT 20
+
+/* Where the pages are mapped. */
+#define UBASE ((uint8_t *) 0x10000000)
+
+static uint64_t *pml4;
+static struct page *pages;
+static struct frame frames[FRAME_CNT];
+static size_t frames_used;
+static struct page *evicted;    /* Page evicted by the last touch(). */
+
+static void start (const char *name);
+static void stop (void);
+static bool touch (size_t, bool write);
+static void check_each_once (const char *name);
+static void check_fifo (void);
+static void check_clock (void);
+static void check_scan (const char *name);
+
+void
+test_evict_policy (void)
+{
+  static const char *names[] = { "clock", "fifo", "2q", "arc" };
+  const struct evict_policy *saved = evict_policy;
+  void *kpage = palloc_get_page (PAL_USER | PAL_ASSERT);
+  size_t i;
+
+  pml4 = pml4_create ();
+  pages = calloc (PAGE_CNT, sizeof *pages);
+  if (pml4 == NULL || pages == NULL)
+    fail ("out of memory");
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      pages[i].va = UBASE + i * PGSIZE;
+      pages[i].pml4 = pml4;
+      if (!pml4_set_page (pml4, pages[i].va, kpage, true))
+        fail ("mapping page %zu failed", i);
+    }
+
+  lock_acquire (&frame_lock);
+  for (i = 0; i < sizeof names / sizeof *names; i++)
+    check_each_once (names[i]);
+  check_fifo ();
+  check_clock ();
+  check_scan ("clock");
+  check_scan ("2q");
+  check_scan ("arc");
+  evict_policy = saved;
+  evict_policy->init ();
+  lock_release (&frame_lock);
+
+  for (i = 0; i < PAGE_CNT; i++)
+    pml4_clear_page (pml4, pages[i].va);
+  pml4_destroy (pml4);
+  palloc_free_page (kpage);
+  free (pages);
+  pass ();
+}
+
+/* Starts policy NAME over, with no page resident. */
+static void
+start (const char *name)
+{
+  size_t i;
+
+  if (!evict_parse_option (name))
+    fail ("there is no policy named %s", name);
+  evict_policy->init ();
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      pages[i].frame = NULL;
+      pages[i].ghost = 0;
+      pml4_set_accessed (pml4, pages[i].va, false);
+      pml4_set_dirty (pml4, pages[i].va, false);
+    }
+  frames_used = 0;
+}
+
+/* Makes FRAME's page stop being resident, as eviction would. */
+static void
+detach (struct frame *frame)
+{
+  struct page *page = frame->page;
+
+  list_remove (&page->frame_elem);
+  page->frame = NULL;
+  frame->page = NULL;
+  pml4_set_accessed (pml4, page->va, false);
+  pml4_set_dirty (pml4, page->va, false);
+}
+
+/* Takes every frame out of the policy, forgets every page, and
+   checks that the policy has nothing left. */
+static void
+stop (void)
+{
+  size_t i;
+
+  for (i = 0; i < frames_used; i++)
+    if (frames[i].page != NULL)
+      {
+        evict_policy->remove (&frames[i]);
+        detach (&frames[i]);
+      }
+  for (i = 0; i < PAGE_CNT; i++)
+    evict_policy->forget (&pages[i]);
+  if (evict_policy->victim () != NULL)
+    fail ("%s returned a victim after every frame was removed",
+          evict_policy->name);
+}
+
+/* Returns a frame taken from the policy, after checking that it
+   is one of ours and holds a page. */
+static struct frame *
+victim (void)
+{
+  struct frame *frame = evict_policy->victim ();
+
+  if (frame == NULL)
+    fail ("%s returned no victim while holding frames",
+          evict_policy->name);
+  if (frame < frames || frame >= frames + frames_used
+      || frame->page == NULL)
+    fail ("%s returned a frame it was not given", evict_policy->name);
+  return frame;
+}
+
+/* Touches page P, writing to it if WRITE.  Returns true if it was
+   resident.  Otherwise faults it in, taking a frame from the
+   policy if all are in use, sets EVICTED to the page that frame
+   held, and returns false. */
+static bool
+touch (size_t p, bool write)
+{
+  struct page *page = &pages[p];
+  struct frame *frame;
+
+  pml4_set_accessed (pml4, page->va, true);
+  if (write)
+    pml4_set_dirty (pml4, page->va, true);
+  evicted = NULL;
+  if (page->frame != NULL)
+    return true;
+
+  if (frames_used < FRAME_CNT)
+    frame = &frames[frames_used++];
+  else
+    {
+      frame = victim ();
+      evicted = frame->page;
+      detach (frame);
+    }
+  list_init (&frame->pages);
+  list_push_back (&frame->pages, &page->frame_elem);
+  frame->page = page;
+  page->frame = frame;
+  evict_policy->insert (frame);
+  return false;
+}
+
+/* Gives policy NAME every frame, takes a few back out, and checks
+   that victim() then returns each of the others exactly once. */
+static void
+check_each_once (const char *name)
+{
+  bool seen[FRAME_CNT];
+  size_t i;
+
+  start (name);
+  for (i = 0; i < FRAME_CNT; i++)
+    touch (i, i % 3 == 0);
+  for (i = 0; i < FRAME_CNT; i += 5)
+    {
+      evict_policy->remove (pages[i].frame);
+      detach (pages[i].frame);
+    }
+
+  memset (seen, 0, sizeof seen);
+  for (i = 0; i < FRAME_CNT; i++)
+    if (i % 5 != 0)
+      {
+        struct frame *frame = victim ();
+
+        if (seen[frame - frames])
+          fail ("%s returned frame %td twice", name, frame - frames);
+        seen[frame - frames] = true;
+        detach (frame);
+      }
+  stop ();
+}
+
+/* Checks that FIFO evicts pages in the order they came in, however
+   often they were touched since. */
+static void
+check_fifo (void)
+{
+  size_t i;
+
+  start ("fifo");
+  for (i = 0; i < FRAME_CNT; i++)
+    touch (i, false);
+  for (i = 0; i < FRAME_CNT; i++)
+    touch (i, i % 2);
+  for (i = 0; i < FRAME_CNT; i++)
+    {
+      touch (FRAME_CNT + i, false);
+      if (evicted != &pages[i])
+        fail ("fifo evicted page %td before page %zu",
+              evicted - pages, i);
+    }
+  stop ();
+}
+
+/* Checks that clock passes over pages that were accessed since the
+   hand last passed, and over dirty pages while it finds clean
+   ones. */
+static void
+check_clock (void)
+{
+  size_t i;
+
+  start ("clock");
+  for (i = 0; i < FRAME_CNT; i++)
+    touch (i, false);
+
+  /* Pages 0 to 3 are accessed again, and page 4 is dirty.  The
+     others, 5 onwards, must go first. */
+  for (i = 0; i < FRAME_CNT; i++)
+    pml4_set_accessed (pml4, pages[i].va, false);
+  for (i = 0; i < 4; i++)
+    pml4_set_accessed (pml4, pages[i].va, true);
+  pml4_set_dirty (pml4, pages[4].va, true);
+
+  for (i = 0; i < FRAME_CNT - 5; i++)
+    {
+      touch (FRAME_CNT + i, false);
+      if (evicted < &pages[5])
+        fail ("clock evicted page %td while clean, unused pages "
+              "were resident", evicted - pages);
+    }
+  stop ();
+}
+
+/* Runs a loop over HOT_CNT hot pages, each round of which also
+   touches the next SCAN_STEP pages of a scan, under policy NAME.
+   The hot pages fit easily, so after a warm-up nearly every touch
+   of them must find them resident. */
+static void
+check_scan (const char *name)
+{
+  size_t round, i, next = HOT_CNT;
+  size_t hits = 0, touches = 0;
+
+  start (name);
+  for (round = 0; round < ROUND_CNT; round++)
+    {
+      for (i = 0; i < HOT_CNT; i++)
+        if (touch (i, i % 2) && round >= WARMUP_CNT)
+          hits++;
+      if (round >= WARMUP_CNT)
+        touches += HOT_CNT;
+      for (i = 0; i < SCAN_STEP; i++)
+        {
+          touch (next, false);
+          if (++next == PAGE_CNT)
+            next = HOT_CNT;
+        }
+    }
+  if (hits * 10 < touches * 9)
+    fail ("%s kept hot pages resident for only %zu of %zu touches "
+          "during a scan", name, hits, touches);
+  stop ();
+}
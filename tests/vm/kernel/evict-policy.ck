@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(evict-policy) begin
+(evict-policy) PASS
+(evict-policy) end
+EOF
+pass;
@@ -0,0 +1,261 @@
+/* Checks the merging of anonymous frames with the same contents.
+   Each test gives the running kernel thread an address space of
+   anonymous pages, claims them, and fills their frames.
+
+   The ksm-merge test merges frames itself, with
+   vm_merge_frames().  Frames with the same contents must be
+   merged: their pages then share the frame that was kept,
+   read-only.  Frames that differ in a single byte must be left
+   alone, and writable.  A write to a merged page must give it a
+   copy of its own, and leave the others sharing, except that the
+   last page left on the frame just gets write access back.
+
+   The ksm-scan test runs with -ksm=100, and waits for the
+   scanning thread to merge the pages with the same contents, and
+   only those.  Then it writes to a merged page, too. */
+
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/ksm.h"
+#include "vm/vm.h"
+
+/* Pages in the address space. */
+#define PAGE_CNT 16
+
+/* Where they are mapped. */
+#define UBASE ((uint8_t *) 0x10000000)
+
+/* How long ksm-scan waits for the scanner, in seconds. */
+#define SCAN_WAIT 10
+
+static struct page *pages[PAGE_CNT];
+
+static void space_create (void);
+static void space_destroy (void);
+static void fill (int page, int pattern);
+static void check_pattern (int page, int pattern, const char *when);
+static bool page_writable (int page);
+static void write_fault (int page);
+
+void
+test_ksm_merge (void)
+{
+  struct frame *shared;
+  bool merged;
+  int i;
+
+  space_create ();
+
+  /* Pages 0 to 2 are the same, pages 3 and 4 differ in one byte,
+     and page 5 is different again. */
+  for (i = 0; i < 3; i++)
+    fill (i, 1);
+  fill (3, 2);
+  fill (4, 2);
+  ((uint8_t *) pages[4]->frame->kva)[PGSIZE - 1] ^= 1;
+  fill (5, 3);
+
+  lock_acquire (&frame_lock);
+  shared = pages[0]->frame;
+  for (i = 1; i < 3; i++)
+    {
+      struct frame *dup = pages[i]->frame;
+
+      if (!vm_merge_frames (shared, dup))
+        fail ("frames of pages 0 and %d, which are the same, "
+              "were not merged", i);
+    }
+  if (vm_merge_frames (pages[3]->frame, pages[4]->frame))
+    fail ("frames that differ in their last byte were merged");
+  merged = vm_merge_frames (shared, pages[5]->frame);
+  lock_release (&frame_lock);
+  if (merged)
+    fail ("frames with different contents were merged");
+
+  for (i = 0; i < 3; i++)
+    {
+      if (pages[i]->frame != shared)
+        fail ("page %d does not have the merged frame", i);
+      if (pml4_get_page (thread_current ()->pml4, pages[i]->va)
+          != shared->kva)
+        fail ("page %d does not map the merged frame", i);
+      if (page_writable (i))
+        fail ("page %d is writable after it was merged", i);
+      check_pattern (i, 1, "after merging");
+    }
+  if (shared->ref_cnt != 3)
+    fail ("merged frame backs %zu pages, not 3", shared->ref_cnt);
+  for (i = 3; i < 6; i++)
+    {
+      if (pages[i]->frame->ref_cnt != 1)
+        fail ("page %d, which was not merged, shares its frame", i);
+      if (!page_writable (i))
+        fail ("page %d, which was not merged, is read-only", i);
+    }
+  check_pattern (3, 2, "after a failed merge");
+  check_pattern (5, 3, "after a failed merge");
+
+  /* Page 1 gets a copy, and so does page 0.  Page 2, the last one
+     left, keeps the frame. */
+  write_fault (1);
+  if (pages[1]->frame == shared || shared->ref_cnt != 2)
+    fail ("page 1 did not get a copy of its own when written");
+  check_pattern (1, 1, "after it was copied on write");
+  fill (1, 4);
+  check_pattern (0, 1, "after a page it was merged with was written");
+  write_fault (0);
+  write_fault (2);
+  if (pages[2]->frame != shared || shared->ref_cnt != 1)
+    fail ("page 2 did not keep the frame it was left alone on");
+  check_pattern (0, 1, "after it was copied on write");
+  check_pattern (2, 1, "after it got write access back");
+
+  space_destroy ();
+  pass ();
+}
+
+void
+test_ksm_scan (void)
+{
+  int64_t start = timer_ticks ();
+  bool done = false;
+  int i;
+
+  if (ksm_cpu_percent == 0)
+    fail ("the scanner is not running");
+  space_create ();
+
+  /* Pages 0 to 7 are the same, and so are pages 8 to 11.  Pages
+     12 to 15 are all different. */
+  for (i = 0; i < PAGE_CNT; i++)
+    fill (i, i < 8 ? 1 : i < 12 ? 2 : i);
+
+  while (!done)
+    {
+      if (timer_elapsed (start) > SCAN_WAIT * TIMER_FREQ)
+        fail ("pages with the same contents were not merged within "
+              "%d seconds", SCAN_WAIT);
+      timer_sleep (TIMER_FREQ / 10);
+
+      lock_acquire (&frame_lock);
+      done = (pages[0]->frame != NULL && pages[0]->frame->ref_cnt == 8
+              && pages[8]->frame != NULL && pages[8]->frame->ref_cnt == 4);
+      lock_release (&frame_lock);
+    }
+
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      struct frame *expected = pages[i < 8 ? 0 : i < 12 ? 8 : i]->frame;
+
+      if (pages[i]->frame != expected)
+        fail ("page %d is not merged with the pages that are the same", i);
+      if (i >= 12 && expected->ref_cnt != 1)
+        fail ("page %d, which is like no other, shares its frame", i);
+      check_pattern (i, i < 8 ? 1 : i < 12 ? 2 : i, "after scanning");
+    }
+
+  write_fault (3);
+  if (pages[3]->frame == pages[0]->frame)
+    fail ("page 3 did not get a copy of its own when written");
+  fill (3, 5);
+  check_pattern (0, 1, "after a page it was merged with was written");
+
+  space_destroy ();
+  pass ();
+}
+
+/* Gives the running thread an address space of PAGE_CNT
+   anonymous pages, each claimed, and zeroed. */
+static void
+space_create (void)
+{
+  struct thread *t = thread_current ();
+  int i;
+
+  t->pml4 = pml4_create ();
+  if (t->pml4 == NULL)
+    fail ("out of memory");
+  supplemental_page_table_init (&t->spt);
+  if (!vm_map_region (VM_ANON, UBASE, PAGE_CNT, true, NULL, 0, 0))
+    fail ("mapping %d pages failed", PAGE_CNT);
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      uint8_t *va = UBASE + i * PGSIZE;
+
+      if (!vm_claim_page (va))
+        fail ("claiming page %d failed", i);
+      pages[i] = spt_find_page (&t->spt, va);
+      if (pages[i] == NULL || pages[i]->frame == NULL)
+        fail ("page %d is not resident after it was claimed", i);
+    }
+}
+
+/* Frees the running thread's address space, the way a process
+   that exits does. */
+static void
+space_destroy (void)
+{
+  struct thread *t = thread_current ();
+  uint64_t *pml4 = t->pml4;
+
+  supplemental_page_table_kill (&t->spt);
+  t->pml4 = NULL;
+  pml4_activate (NULL);
+  pml4_destroy (pml4);
+}
+
+/* Fills PAGE's frame with a pattern that depends on PATTERN.  Must
+   not be called on a frame that is shared. */
+static void
+fill (int page, int pattern)
+{
+  uint8_t *kva = pages[page]->frame->kva;
+  size_t i;
+
+  for (i = 0; i < PGSIZE; i++)
+    kva[i] = (uint8_t) (pattern * 37 + i / 8);
+}
+
+/* Fails unless PAGE holds what fill() put there for PATTERN.  WHEN
+   is for the failure message. */
+static void
+check_pattern (int page, int pattern, const char *when)
+{
+  const uint8_t *kva = pages[page]->frame->kva;
+  size_t i;
+
+  for (i = 0; i < PGSIZE; i++)
+    if (kva[i] != (uint8_t) (pattern * 37 + i / 8))
+      fail ("byte %zu of page %d changed %s", i, page, when);
+}
+
+/* Returns true if PAGE is mapped writable. */
+static bool
+page_writable (int page)
+{
+  uint64_t *pte = pml4e_walk (thread_current ()->pml4,
+                              (uint64_t) pages[page]->va, 0);
+
+  return pte != NULL && (*pte & PTE_P) && (*pte & PTE_W);
+}
+
+/* Handles a write to PAGE, which is mapped read-only, the way the
+   page fault handler would for a user process, and checks that
+   PAGE is then writable. */
+static void
+write_fault (int page)
+{
+  struct intr_frame f;
+
+  memset (&f, 0, sizeof f);
+  if (!vm_try_handle_fault (&f, pages[page]->va, true, true, false))
+    fail ("a write to page %d, which is shared, was not handled", page);
+  if (!page_writable (page))
+    fail ("page %d is still read-only after a write to it", page);
+}
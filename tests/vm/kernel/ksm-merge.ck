@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(ksm-merge) begin
+(ksm-merge) PASS
+(ksm-merge) end
+EOF
+pass;
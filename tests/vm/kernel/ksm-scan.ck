@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(ksm-scan) begin
+(ksm-scan) PASS
+(ksm-scan) end
+EOF
+pass;
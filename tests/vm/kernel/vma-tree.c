@@ -0,0 +1,285 @@
+/* Checks the interval tree of VMAs against a plain array that
+   records which VMA owns each page.  Random inserts, removals and
+   resizes must keep the tree a balanced search tree with correct
+   heights and end addresses, inserts must fail exactly when they
+   would overlap, and lookups and walks must agree with the
+   array. */
+
+#include <random.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+/* Pages of address space the VMAs live in. */
+#define SPAN 1024
+
+/* VMAs, in the tree or not. */
+#define VMA_CNT 200
+
+/* Longest VMA, in pages. */
+#define MAX_LEN 8
+
+/* Random operations. */
+#define OP_CNT 6000
+
+/* Where the address space starts. */
+#define UBASE ((uint8_t *) 0x10000000)
+
+static struct vma_tree tree;
+static struct vma *vmas;
+static bool in_tree[VMA_CNT];
+static int owner[SPAN];         /* Index of a page's VMA, or -1. */
+
+static void try_insert (int);
+static void try_remove (int);
+static void try_resize (int);
+static void check_tree (void);
+static void check_lookups (void);
+
+void
+test_vma_tree (void)
+{
+  int i;
+
+  vmas = calloc (VMA_CNT, sizeof *vmas);
+  if (vmas == NULL)
+    fail ("out of memory");
+  for (i = 0; i < SPAN; i++)
+    owner[i] = -1;
+  vma_tree_init (&tree);
+  random_init (0);
+
+  for (i = 0; i < OP_CNT; i++)
+    {
+      int v = random_ulong () % VMA_CNT;
+
+      if (!in_tree[v])
+        try_insert (v);
+      else if (random_ulong () % 3 == 0)
+        try_remove (v);
+      else
+        try_resize (v);
+      check_tree ();
+      if (i % 16 == 0)
+        check_lookups ();
+    }
+
+  for (i = 0; i < VMA_CNT; i++)
+    if (in_tree[i])
+      {
+        try_remove (i);
+        check_tree ();
+      }
+  if (tree.root != NULL || tree.cnt != 0)
+    fail ("tree is not empty after removing every VMA");
+  free (vmas);
+  pass ();
+}
+
+/* Returns the page number of address VA. */
+static int
+page_of (const uint8_t *va)
+{
+  return (va - UBASE) / PGSIZE;
+}
+
+/* Returns the address of page P. */
+static uint8_t *
+page_addr (int p)
+{
+  return UBASE + p * PGSIZE;
+}
+
+/* Records that pages [START, END) belong to VMA V, or to none if
+   V is -1. */
+static void
+set_owner (int start, int end, int v)
+{
+  int p;
+
+  for (p = start; p < end; p++)
+    owner[p] = v;
+}
+
+/* Returns true if none of pages [START, END) belongs to a VMA. */
+static bool
+is_free (int start, int end)
+{
+  int p;
+
+  for (p = start; p < end; p++)
+    if (owner[p] != -1)
+      return false;
+  return true;
+}
+
+/* Gives VMA V a random range and inserts it, which must succeed
+   if and only if the range is free. */
+static void
+try_insert (int v)
+{
+  struct vma *vma = &vmas[v];
+  int len = random_ulong () % MAX_LEN + 1;
+  int start = random_ulong () % (SPAN - len + 1);
+  bool expected = is_free (start, start + len);
+
+  vma->start = page_addr (start);
+  vma->end = page_addr (start + len);
+  if (vma_insert (&tree, vma) != expected)
+    fail ("inserting pages %d to %d %s", start, start + len,
+          expected ? "failed" : "succeeded despite an overlap");
+  if (expected)
+    {
+      in_tree[v] = true;
+      set_owner (start, start + len, v);
+    }
+}
+
+/* Removes VMA V from the tree. */
+static void
+try_remove (int v)
+{
+  vma_remove (&tree, &vmas[v]);
+  in_tree[v] = false;
+  set_owner (page_of (vmas[v].start), page_of (vmas[v].end), -1);
+}
+
+/* Moves the end of VMA V by a page, or its start up by a page,
+   whichever fits. */
+static void
+try_resize (int v)
+{
+  struct vma *vma = &vmas[v];
+  int start = page_of (vma->start), end = page_of (vma->end);
+
+  switch (random_ulong () % 3)
+    {
+    case 0:
+      if (end < SPAN && owner[end] == -1)
+        {
+          owner[end] = v;
+          vma->end += PGSIZE;
+        }
+      break;
+
+    case 1:
+      if (end - start > 1)
+        {
+          owner[end - 1] = -1;
+          vma->end -= PGSIZE;
+        }
+      break;
+
+    case 2:
+      if (end - start > 1)
+        {
+          owner[start] = -1;
+          vma->start += PGSIZE;
+        }
+      break;
+    }
+  vma_update (vma);
+}
+
+/* Checks the subtree rooted at V, whose parent must be PARENT and
+   whose VMAs must lie within [LO, HI).  Returns its height, and
+   adds the number of its nodes to *CNT. */
+static int
+check_subtree (struct vma *v, struct vma *parent, uint8_t *lo, uint8_t *hi,
+               size_t *cnt)
+{
+  uint8_t *max_end;
+  int lh, rh;
+
+  if (v == NULL)
+    return 0;
+  if (v->parent != parent)
+    fail ("VMA at %p has the wrong parent", v->start);
+  if (v->start < lo || v->end > hi || v->start >= v->end)
+    fail ("VMA %p-%p is out of order or overlaps another", v->start, v->end);
+  if (owner[page_of (v->start)] != v - vmas)
+    fail ("VMA at %p is in the tree but should not be", v->start);
+
+  lh = check_subtree (v->left, v, lo, v->start, cnt);
+  rh = check_subtree (v->right, v, v->end, hi, cnt);
+  if (lh - rh > 1 || rh - lh > 1)
+    fail ("VMA at %p has subtrees of heights %d and %d", v->start, lh, rh);
+  if (v->height != (lh > rh ? lh : rh) + 1)
+    fail ("VMA at %p has height %d, not %d",
+          v->start, v->height, (lh > rh ? lh : rh) + 1);
+
+  max_end = v->end;
+  if (v->left != NULL && v->left->max_end > max_end)
+    max_end = v->left->max_end;
+  if (v->right != NULL && v->right->max_end > max_end)
+    max_end = v->right->max_end;
+  if (v->max_end != max_end)
+    fail ("VMA at %p has max_end %p, not %p", v->start, v->max_end, max_end);
+
+  ++*cnt;
+  return (lh > rh ? lh : rh) + 1;
+}
+
+/* Checks the shape and fields of the whole tree, and that it
+   holds exactly the VMAs it should. */
+static void
+check_tree (void)
+{
+  size_t cnt = 0, expected = 0;
+  int i;
+
+  check_subtree (tree.root, NULL, UBASE, page_addr (SPAN), &cnt);
+  for (i = 0; i < VMA_CNT; i++)
+    if (in_tree[i])
+      expected++;
+  if (cnt != expected || tree.cnt != expected)
+    fail ("tree holds %zu VMAs and counts %zu, not %zu",
+          cnt, tree.cnt, expected);
+}
+
+/* Checks vma_find(), vma_first_overlap(), and a walk with
+   vma_first() and vma_next(), against the page owners. */
+static void
+check_lookups (void)
+{
+  struct vma *v;
+  int p, i;
+
+  for (p = 0; p < SPAN; p++)
+    {
+      uint8_t *va = page_addr (p) + random_ulong () % PGSIZE;
+
+      v = vma_find (&tree, va);
+      if (owner[p] == -1 ? v != NULL : v != &vmas[owner[p]])
+        fail ("vma_find(%p) found the wrong VMA", va);
+    }
+
+  for (i = 0; i < 64; i++)
+    {
+      int start = random_ulong () % SPAN;
+      int end = start + random_ulong () % (2 * MAX_LEN) + 1;
+      struct vma *expected = NULL;
+
+      if (end > SPAN)
+        end = SPAN;
+      for (p = start; p < end && expected == NULL; p++)
+        if (owner[p] != -1)
+          expected = &vmas[owner[p]];
+      if (vma_first_overlap (&tree, page_addr (start), page_addr (end))
+          != expected)
+        fail ("vma_first_overlap() of pages %d to %d found the wrong VMA",
+              start, end);
+    }
+
+  v = vma_first (&tree);
+  for (p = 0; p < SPAN; p++)
+    if (owner[p] != -1 && (p == 0 || owner[p - 1] != owner[p]))
+      {
+        if (v != &vmas[owner[p]])
+          fail ("walking the tree skipped the VMA at page %d", p);
+        v = vma_next (v);
+      }
+  if (v != NULL)
+    fail ("walking the tree found a VMA past the last");
+}
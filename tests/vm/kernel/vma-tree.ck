@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(vma-tree) begin
+(vma-tree) PASS
+(vma-tree) end
+EOF
+pass;
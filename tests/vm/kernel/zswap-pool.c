@@ -0,0 +1,231 @@
+/* Checks zswap, the compressed cache of anonymous pages in front
+   of the swap disk.  Pages that compress must be stored, and must
+   come back unchanged whether they are copied out or leave the
+   pool.  Pages that do not compress must be refused, and pages
+   invalidated in the pool must not be found there again.  Storing
+   twice as much as the pool holds must write the pages stored
+   first back to the swap disk, from which they must come back
+   unchanged too.  Once they are freed, the pool must have room
+   again. */
+
+#include <bitmap.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+#include "vm/zswap.h"
+
+/* Where the pages would be mapped; only used in messages. */
+#define UBASE ((uint8_t *) 0x10000000)
+
+static struct page *pages;
+static size_t page_cnt;
+static uint8_t *buf, *out;
+
+static void check_store_load (void);
+static void check_reject (void);
+static void check_invalidate (void);
+static void check_writeback (void);
+
+void
+test_zswap_pool (void)
+{
+  size_t i;
+
+  if (zswap_pool_pages == 0)
+    fail ("zswap is turned off");
+  page_cnt = 2 * zswap_pool_pages + 16;
+  pages = calloc (page_cnt, sizeof *pages);
+  buf = palloc_get_page (PAL_ASSERT);
+  out = palloc_get_page (PAL_ASSERT);
+  if (pages == NULL)
+    fail ("out of memory");
+  for (i = 0; i < page_cnt; i++)
+    {
+      pages[i].va = UBASE + i * PGSIZE;
+      anon_initializer (&pages[i], VM_ANON, NULL);
+    }
+
+  check_store_load ();
+  check_reject ();
+  check_invalidate ();
+  check_writeback ();
+
+  palloc_free_page (out);
+  palloc_free_page (buf);
+  free (pages);
+  pass ();
+}
+
+/* Fills the page at KVA with the contents of page SEED: random
+   words in its first half, zeros in the second, so that it
+   compresses to about half its size. */
+static void
+fill (void *kva, size_t seed)
+{
+  uint64_t *w = kva;
+  uint64_t x = seed * 0x9e3779b97f4a7c15ULL + 1;
+  size_t i;
+
+  for (i = 0; i < PGSIZE / sizeof *w; i++)
+    {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      w[i] = i < PGSIZE / sizeof *w / 2 ? x : 0;
+    }
+}
+
+/* Stores page I, filled as fill() does, and fails if it is not
+   stored. */
+static void
+store (size_t i)
+{
+  fill (buf, i);
+  if (!zswap_store (&pages[i], buf))
+    fail ("storing page %zu failed", i);
+  if (pages[i].anon.zchunk == BITMAP_ERROR)
+    fail ("page %zu was stored, but is not in the pool", i);
+}
+
+/* Fails unless OUT holds the contents of page I. */
+static void
+check_contents (size_t i, const char *how)
+{
+  fill (buf, i);
+  if (memcmp (out, buf, PGSIZE))
+    fail ("page %zu came back changed %s", i, how);
+}
+
+/* Stores pages, copies them out twice, then loads them out of the
+   pool. */
+static void
+check_store_load (void)
+{
+  size_t i;
+
+  for (i = 0; i < 32; i++)
+    store (i);
+  for (i = 0; i < 32; i++)
+    {
+      memset (out, 0xcc, PGSIZE);
+      if (!zswap_load (&pages[i], out, true))
+        fail ("page %zu was not found in the pool", i);
+      check_contents (i, "when copied out");
+      memset (out, 0xcc, PGSIZE);
+      if (!zswap_load (&pages[i], out, false))
+        fail ("page %zu was not found in the pool after a copy", i);
+      check_contents (i, "when loaded");
+      if (zswap_load (&pages[i], out, true))
+        fail ("page %zu was still in the pool after it was loaded", i);
+    }
+}
+
+/* Checks that a page of random bytes is refused, and that a page
+   of zeros takes almost no room. */
+static void
+check_reject (void)
+{
+  uint64_t *w = (uint64_t *) buf;
+  size_t i;
+
+  fill (buf, 0);
+  for (i = PGSIZE / sizeof *w / 2; i < PGSIZE / sizeof *w; i++)
+    w[i] = w[i - PGSIZE / sizeof *w / 2] * 3 + i;
+  if (zswap_store (&pages[0], buf))
+    fail ("a page of random bytes was stored");
+  if (pages[0].anon.zchunk != BITMAP_ERROR)
+    fail ("a page that was refused is in the pool");
+
+  memset (buf, 0, PGSIZE);
+  if (!zswap_store (&pages[0], buf))
+    fail ("a page of zeros was not stored");
+  if (pages[0].anon.zsize > PGSIZE / 32)
+    fail ("a page of zeros took %u bytes", pages[0].anon.zsize);
+  memset (out, 0xcc, PGSIZE);
+  if (!zswap_load (&pages[0], out, false) || memcmp (out, buf, PGSIZE))
+    fail ("a page of zeros did not come back");
+}
+
+/* Stores pages, invalidates every other one, and checks that only
+   the others are found. */
+static void
+check_invalidate (void)
+{
+  size_t i;
+
+  for (i = 0; i < 32; i++)
+    store (i);
+  for (i = 1; i < 32; i += 2)
+    zswap_invalidate (&pages[i]);
+  for (i = 0; i < 32; i++)
+    {
+      bool found = zswap_load (&pages[i], out, false);
+
+      if (i % 2 && found)
+        fail ("page %zu was found after it was invalidated", i);
+      if (i % 2 == 0 && !found)
+        fail ("page %zu was lost when others were invalidated", i);
+      if (found)
+        check_contents (i, "after others were invalidated");
+    }
+
+  /* Invalidating a page that is not in the pool does nothing. */
+  zswap_invalidate (&pages[0]);
+}
+
+/* Stores more pages than the pool holds, and checks that the
+   oldest went to the swap disk, and that every page comes back
+   from wherever it is. */
+static void
+check_writeback (void)
+{
+  size_t i, pooled = 0, first_pooled = page_cnt;
+
+  for (i = 0; i < page_cnt; i++)
+    store (i);
+  for (i = 0; i < page_cnt; i++)
+    {
+      struct anon_page *anon = &pages[i].anon;
+
+      if (anon->zchunk != BITMAP_ERROR)
+        {
+          pooled++;
+          if (first_pooled == page_cnt)
+            first_pooled = i;
+        }
+      else if (anon->slot == BITMAP_ERROR)
+        fail ("page %zu is neither in the pool nor on disk", i);
+      else if (first_pooled < i)
+        fail ("page %zu was written back before older page %zu",
+              i, first_pooled);
+    }
+  if (pooled == page_cnt)
+    fail ("%zu pages, twice the pool, fit in it", page_cnt);
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      memset (out, 0xcc, PGSIZE);
+      if (!swap_in (&pages[i], out))
+        fail ("swapping in page %zu failed", i);
+      check_contents (i, pages[i].anon.zchunk != BITMAP_ERROR
+                      ? "from the pool" : "from the swap disk");
+      destroy (&pages[i]);
+      if (pages[i].anon.zchunk != BITMAP_ERROR
+          || pages[i].anon.slot != BITMAP_ERROR)
+        fail ("page %zu kept its place in the pool or on disk", i);
+    }
+
+  /* The pool is empty again, so half as many pages as it held
+     must fit without writing any back. */
+  for (i = 0; i < pooled / 2; i++)
+    store (i);
+  for (i = 0; i < pooled / 2; i++)
+    {
+      if (pages[i].anon.slot != BITMAP_ERROR)
+        fail ("page %zu was written back to an emptied pool", i);
+      zswap_invalidate (&pages[i]);
+    }
+}
@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(zswap-pool) begin
+(zswap-pool) PASS
+(zswap-pool) end
+EOF
+pass;
@@ -19,8 +19,11 @@
 #include "threads/malloc.h"
 #include "threads/mmu.h"
 #include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/vmalloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -31,6 +34,9 @@
 #include "tests/threads/tests.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/evict.h"
+#include "vm/ksm.h"
+#include "vm/zswap.h"
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
@@ -85,6 +91,7 @@ main (void) {
 	/* Initialize memory system. */
 	mem_end = palloc_init ();
 	malloc_init ();
+	kmem_cache_init ();
 	paging_init (mem_end);
 
 #ifdef USERPROG
@@ -103,8 +110,15 @@ main (void) {
 #endif
 	/* Start thread scheduler and enable interrupts. */
 	thread_start ();
+#ifdef USERPROG
+	/* Only user processes fault in enough zeroed pages to make
+	   zeroing them in advance worth another thread, which would
+	   disturb the timing of the threads tests. */
+	palloc_start_zeroing ();
+#endif
 	serial_init_queue ();
 	timer_calibrate ();
+	trace_init ();
 
 #ifdef FILESYS
 	/* Initialize file system. */
@@ -152,10 +166,23 @@ paging_init (uint64_t mem_end) {
 	extern char start, _end_kernel_text;
 	// Maps physical address [0 ~ mem_end] to
 	//   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
+	// Use 2 MB pages wherever they fit, but 4 kB pages around the
+	// kernel text, which must stay read-only.  (1 GB pages would
+	// need KERN_BASE to be 1 GB aligned, which it is not.)
+	// Every process shares these mappings, so they are global.
 	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
 		uint64_t va = (uint64_t) ptov(pa);
 
-		perm = PTE_P | PTE_W;
+		if (pa % LARGE_PGSIZE == 0 && mem_end - pa >= LARGE_PGSIZE
+				&& (va + LARGE_PGSIZE <= (uint64_t) &start
+					|| va >= (uint64_t) &_end_kernel_text)) {
+			if ((pte = pml4e_walk_pde (pml4, va, 1)) != NULL)
+				*pte = pa | PTE_PS | PTE_G | PTE_P | PTE_W;
+			pa += LARGE_PGSIZE - PGSIZE;
+			continue;
+		}
+
+		perm = PTE_G | PTE_P | PTE_W;
 		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
 			perm &= ~PTE_W;
 
@@ -163,7 +190,10 @@ paging_init (uint64_t mem_end) {
 			*pte = pa | perm;
 	}
 
+	vmalloc_init ();
+
 	// reload cr3
+	mmu_init ();
 	pml4_activate(0);
 }
 
@@ -221,11 +251,29 @@ parse_options (char **argv) {
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+		else if (!strcmp (name, "-mhist"))
+			malloc_histogram = true;
+		else if (!strcmp (name, "-trace")) {
+			if (!trace_parse_option (value))
+				PANIC ("unknown trace event in `%s'", value);
+		}
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-evict")) {
+			if (!evict_parse_option (value))
+				PANIC ("unknown eviction policy `%s'", value);
+		}
+		else if (!strcmp (name, "-swap-ra"))
+			anon_ra_window = atoi (value);
+		else if (!strcmp (name, "-zswap"))
+			zswap_pool_pages = atoi (value);
+		else if (!strcmp (name, "-ksm"))
+			ksm_cpu_percent = atoi (value);
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -326,8 +374,20 @@ usage (void) {
 			"  -f                 Format file system disk during startup.\n"
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
+			"  -mhist             Print a histogram of malloc() sizes at power off.\n"
+			"  -trace[=EV,...]    Record EVents (sched, fault, syscall, disk,\n"
+			"                     lock; default all) and dump them at power off.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -evict=POLICY      Evict pages by POLICY (clock, fifo, 2q, arc).\n"
+			"  -swap-ra=N         Read N swap slots around each one swapped in\n"
+			"                     (default 8, at most 32; 0 or 1 for none).\n"
+			"  -zswap=N           Keep evicted pages compressed in N pages of\n"
+			"                     kernel memory before swapping (default 256).\n"
+			"  -ksm=PERCENT       Merge identical anonymous pages, using up to\n"
+			"                     PERCENT of the CPU (default 0, for off).\n"
 #endif
 			);
 	power_off ();
@@ -343,6 +403,7 @@ power_off (void) {
 #endif
 
 	print_stats ();
+	trace_dump ();
 
 	printf ("Powering off...\n");
 	outw (0x604, 0x2000);               /* Poweroff command for qemu */
@@ -354,6 +415,10 @@ static void
 print_stats (void) {
 	timer_print_stats ();
 	thread_print_stats ();
+	palloc_print_stats ();
+	mmu_print_stats ();
+	kmem_cache_print_stats ();
+	malloc_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
 #endif
@@ -362,4 +427,7 @@ print_stats (void) {
 #ifdef USERPROG
 	exception_print_stats ();
 #endif
+#ifdef VM
+	vm_print_stats ();
+#endif
 }
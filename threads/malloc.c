@@ -8,14 +8,21 @@
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "threads/vmalloc.h"
 
 /* A simple implementation of malloc().
 
-   The size of each request, in bytes, is rounded up to a power
-   of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
-   the free list is nonempty, one of its blocks is used to
-   satisfy the request.
+   The size of each request, in bytes, is rounded up to the
+   nearest size class and assigned to the "descriptor" that
+   manages blocks of that size.  The classes are the powers of 2
+   from 16 bytes to 1 kB, with one more class halfway between
+   each pair (48, 96, 192, ...), so that no block of up to 1.5 kB
+   is more than about a third bigger than the request it
+   satisfies.  Past that, an arena only has room for a single
+   block, so one 3 kB class serves every request from 1.5 kB to
+   3 kB: a 2 kB class would take just as much memory.  The
+   descriptor keeps a list of free blocks.  If the free list is
+   nonempty, one of its blocks is used to satisfy the request.
 
    Otherwise, a new page of memory, called an "arena", is
    obtained from the page allocator (if none is available,
@@ -28,11 +35,12 @@
    blocks, we remove all of the arena's blocks from the free list
    and give the arena back to the page allocator.
 
-   We can't handle blocks bigger than 2 kB using this scheme,
+   We can't handle blocks bigger than 3 kB using this scheme,
    because they're too big to fit in a single page with a
-   descriptor.  We handle those by allocating contiguous pages
-   with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   descriptor.  We handle those by allocating pages, virtually
+   contiguous ones from vmalloc() if there is more than one, and
+   sticking the allocation size at the beginning of the allocated
+   block's arena header. */
 
 /* Descriptor. */
 struct desc {
@@ -57,9 +65,37 @@ struct block {
 	struct list_elem free_elem; /* Free list element. */
 };
 
+/* Block sizes of the descriptors, in increasing order.  Each
+   must be a multiple of SIZE_STEP.  There is no 2048: two 2 kB
+   blocks do not fit in an arena alongside its header. */
+static const size_t class_sizes[] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 3072,
+};
+#define DESC_CNT (sizeof class_sizes / sizeof *class_sizes)
+#define MAX_BLOCK_SIZE 3072
+
+/* Granularity of the size-to-descriptor lookup table. */
+#define SIZE_STEP 16
+
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
-static size_t desc_cnt;         /* Number of descriptors. */
+static struct desc descs[DESC_CNT];
+
+/* size_to_desc[(SIZE - 1) / SIZE_STEP] is the index of the
+   descriptor for a SIZE-byte request, for SIZE up to
+   MAX_BLOCK_SIZE. */
+static uint8_t size_to_desc[MAX_BLOCK_SIZE / SIZE_STEP];
+
+/* If true, malloc() records a histogram of request sizes.  Set
+   by the "-mhist" kernel command line option. */
+bool malloc_histogram;
+
+/* Request size histogram.  Bucket I counts requests for
+   I * SIZE_STEP + 1 through (I + 1) * SIZE_STEP bytes; the last
+   bucket counts requests too big for any descriptor. */
+#define HIST_BUCKETS (MAX_BLOCK_SIZE / SIZE_STEP + 1)
+static uint64_t hist_cnt[HIST_BUCKETS];     /* Requests. */
+static uint64_t hist_bytes[HIST_BUCKETS];   /* Bytes requested. */
+static uint64_t hist_big_pages;             /* Pages taken by big blocks. */
 
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
@@ -67,16 +103,35 @@ static struct block *arena_to_block (struct arena *, size_t idx);
 /* Initializes the malloc() descriptors. */
 void
 malloc_init (void) {
-	size_t block_size;
-
-	for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2) {
-		struct desc *d = &descs[desc_cnt++];
-		ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
-		d->block_size = block_size;
-		d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
+	size_t i, step = 0;
+
+	for (i = 0; i < DESC_CNT; i++) {
+		struct desc *d = &descs[i];
+		d->block_size = class_sizes[i];
+		d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / d->block_size;
+		ASSERT (d->block_size % SIZE_STEP == 0);
+		ASSERT (d->blocks_per_arena > 0);
 		list_init (&d->free_list);
 		lock_init (&d->lock);
+
+		for (; step < d->block_size / SIZE_STEP; step++)
+			size_to_desc[step] = i;
 	}
+	ASSERT (step == MAX_BLOCK_SIZE / SIZE_STEP);
+}
+
+/* Counts a SIZE-byte request in the histogram. */
+static void
+hist_record (size_t size) {
+	size_t bucket = size <= MAX_BLOCK_SIZE
+		? (size - 1) / SIZE_STEP : HIST_BUCKETS - 1;
+
+	__atomic_fetch_add (&hist_cnt[bucket], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add (&hist_bytes[bucket], size, __ATOMIC_RELAXED);
+	if (size > MAX_BLOCK_SIZE)
+		__atomic_fetch_add (&hist_big_pages,
+				DIV_ROUND_UP (size + sizeof (struct arena), PGSIZE),
+				__ATOMIC_RELAXED);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
@@ -91,16 +146,14 @@ malloc (size_t size) {
 	if (size == 0)
 		return NULL;
 
-	/* Find the smallest descriptor that satisfies a SIZE-byte
-	   request. */
-	for (d = descs; d < descs + desc_cnt; d++)
-		if (d->block_size >= size)
-			break;
-	if (d == descs + desc_cnt) {
+	if (malloc_histogram)
+		hist_record (size);
+
+	if (size > MAX_BLOCK_SIZE) {
 		/* SIZE is too big for any descriptor.
 		   Allocate enough pages to hold SIZE plus an arena. */
 		size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
-		a = palloc_get_multiple (0, page_cnt);
+		a = page_cnt > 1 ? vmalloc (0, page_cnt) : palloc_get_page (0);
 		if (a == NULL)
 			return NULL;
 
@@ -112,6 +165,9 @@ malloc (size_t size) {
 		return a + 1;
 	}
 
+	/* Find the smallest descriptor that satisfies a SIZE-byte
+	   request. */
+	d = &descs[size_to_desc[(size - 1) / SIZE_STEP]];
 	lock_acquire (&d->lock);
 
 	/* If the free list is empty, create a new arena. */
@@ -233,12 +289,64 @@ free (void *p) {
 			lock_release (&d->lock);
 		} else {
 			/* It's a big block.  Free its pages. */
-			palloc_free_multiple (a, a->free_cnt);
+			if (is_vmalloc_vaddr (a))
+				vfree (a, a->free_cnt);
+			else
+				palloc_free_page (a);
 			return;
 		}
 	}
 }
 
+/* Returns the block size that the old power-of-2 scheme would
+   have used for a request of up to SIZE bytes.  Requests above
+   PGSIZE / 4 took a whole page. */
+static size_t
+pow2_block_size (size_t size) {
+	size_t block_size = 16;
+
+	if (size > PGSIZE / 4)
+		return PGSIZE;
+	while (block_size < size)
+		block_size *= 2;
+	return block_size;
+}
+
+/* Prints the request size histogram, if it was recorded, and
+   compares the memory the size classes used with what
+   power-of-2 classes would have used. */
+void
+malloc_print_stats (void) {
+	uint64_t requested = 0, allocated = 0, pow2 = 0;
+	size_t i;
+
+	if (!malloc_histogram)
+		return;
+
+	printf ("Malloc: request size histogram:\n");
+	for (i = 0; i < HIST_BUCKETS - 1; i++) {
+		size_t hi = (i + 1) * SIZE_STEP;
+		size_t block_size = descs[size_to_desc[i]].block_size;
+
+		if (hist_cnt[i] == 0)
+			continue;
+		printf ("Malloc: %5zu-%-5zu bytes: %8llu requests, %zu-byte blocks\n",
+				hi - SIZE_STEP + 1, hi, hist_cnt[i], block_size);
+		requested += hist_bytes[i];
+		allocated += hist_cnt[i] * block_size;
+		pow2 += hist_cnt[i] * pow2_block_size (hi);
+	}
+	if (hist_cnt[i] != 0) {
+		printf ("Malloc: %5d+      bytes: %8llu requests, %llu pages\n",
+				MAX_BLOCK_SIZE + 1, hist_cnt[i], hist_big_pages);
+		requested += hist_bytes[i];
+		allocated += hist_big_pages * PGSIZE;
+		pow2 += hist_big_pages * PGSIZE;
+	}
+	printf ("Malloc: %llu bytes requested, %llu allocated, "
+			"%llu with power-of-2 classes\n", requested, allocated, pow2);
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b) {
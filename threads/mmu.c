@@ -1,13 +1,88 @@
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
+#include "threads/cpu.h"
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Process-context identifiers (PCIDs).
+
+   Without PCIDs, every CR3 load flushes the TLB, so switching
+   between two processes costs each of them its TLB entries,
+   however briefly the other one ran.  With CR4.PCIDE set, TLB
+   entries are tagged with the 12-bit PCID in CR3, and a CR3 load
+   with CR3_NOFLUSH set keeps the entries of every PCID.
+
+   Each CPU hands out PCID_CNT PCIDs to the address spaces it
+   most recently ran, recycling them round-robin.  PCID 0 belongs
+   to base_pml4, which is always loaded with a flush.  Loading an
+   address space that has a PCID already reuses its TLB entries;
+   giving a PCID to a new address space loads CR3 without
+   CR3_NOFLUSH, which flushes just that PCID's entries, left over
+   from its previous owner.
+
+   Kernel mappings, which every address space shares, are global
+   (PTE_G): CR4.PGE keeps them across all CR3 loads.
+
+   TLB shootdown.
+
+   When a mapping changes, every CPU that may hold a TLB entry for
+   it must drop the entry.  tlb_shootdown() sorts the CPUs by what
+   they hold.  The running CPU, which has the address space active
+   or is changing a kernel mapping, flushes at once with invlpg.
+   A CPU that merely has the address space's entries cached under
+   a PCID is not interrupted: the PCID is marked stale and flushed
+   when the CPU next loads it.
+
+   Pintos runs on a single CPU, so no other CPU can have the
+   address space active, and there is no inter-processor interrupt
+   to send; tlb_shootdown() asserts as much.  The flush paths all
+   go through it all the same. */
+#define PCID_CNT 16
+
+/* CR3 and CR4 bits. */
+#define CR3_NOFLUSH (1ULL << 63)     /* Keep the TLB entries of the PCID. */
+#define CR4_PGE (1 << 7)             /* Page global enable. */
+#define CR4_PCIDE (1 << 17)          /* PCID enable. */
+
+/* CPUID.01H feature bits. */
+#define CPUID_EDX_PGE (1 << 13)
+#define CPUID_ECX_PCID (1 << 17)
+
+/* Flush every TLB entry, in a tlb_shootdown() page count. */
+#define TLB_FLUSH_ALL SIZE_MAX
+
+/* Per-CPU MMU state.  Accessed with interrupts off. */
+struct mmu_cpu {
+	uint64_t *active;           /* Page map level 4 in CR3. */
+	uint64_t *owner[PCID_CNT];  /* Address space holding PCID i + 1. */
+	bool stale[PCID_CNT];       /* Flush PCID i + 1 on next load? */
+	unsigned next;              /* Next PCID to recycle, minus 1. */
+	uint64_t hits;              /* Loads that kept the TLB entries. */
+	uint64_t stale_flushes;     /* Loads that flushed a stale PCID. */
+	uint64_t recycles;          /* Loads that took over a PCID. */
+};
+
+static struct mmu_cpu mmu_cpus[CPU_CNT];
+static bool pcid_enabled;
+
+/* TLB statistics. */
+static uint64_t gather_cnt;         /* mmu_gather batches finished. */
+static uint64_t shootdown_cnt;      /* Calls to tlb_shootdown(). */
+static uint64_t pages_flushed;      /* Pages invalidated one by one. */
+static uint64_t full_flushes;       /* Whole address spaces flushed. */
+static uint64_t lazy_flushes;       /* PCIDs marked stale on other CPUs. */
+
+static void pcid_forget (uint64_t *pml4);
+static bool is_active (uint64_t *pml4);
+static void tlb_shootdown (uint64_t *pml4, const uint64_t *va, size_t cnt);
+
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
@@ -23,6 +98,8 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
+		if (pdp[idx] & PTE_PS)
+			return &pdp[idx];
 		return (uint64_t *) ptov (PTE_ADDR (pdp[idx]) + 8 * PTX (va));
 	}
 	return NULL;
@@ -46,6 +123,8 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
+		if (pdpe[idx] & PTE_PS)
+			return &pdpe[idx];
 		pte = pgdir_walk (ptov (PTE_ADDR (pdpe[idx])), va, create);
 	}
 	if (pte == NULL && allocated) {
@@ -60,7 +139,10 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
  * If PML4E does not have a page table for VADDR, behavior depends
  * on CREATE.  If CREATE is true, then a new page table is
  * created and a pointer into it is returned.  Otherwise, a null
- * pointer is returned. */
+ * pointer is returned.
+ * If VADDR is mapped by a large page, returns the address of the
+ * page directory (pointer) entry that maps it, which has PTE_PS
+ * set. */
 uint64_t *
 pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	uint64_t *pte = NULL;
@@ -88,6 +170,37 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the table that ENTRY points to.  If ENTRY is not
+ * present and CREATE is true, points it to a new, empty table
+ * first; if CREATE is false, returns a null pointer. */
+static uint64_t *
+next_table (uint64_t *entry, int create) {
+	if (!(*entry & PTE_P)) {
+		uint64_t *table = create ? palloc_get_page (PAL_ZERO) : NULL;
+		if (table == NULL)
+			return NULL;
+		*entry = vtop (table) | PTE_U | PTE_W | PTE_P;
+	}
+	return ptov (PTE_ADDR (*entry));
+}
+
+/* Returns the address of the page directory entry for virtual
+ * address VA in PML4, through which VA can be mapped with a
+ * 2 MB page (see LARGE_PGSIZE).  Missing tables on the way are
+ * created if CREATE is true; otherwise, or if memory runs out,
+ * returns a null pointer.  Also returns a null pointer if VA
+ * lies in a 1 GB page. */
+uint64_t *
+pml4e_walk_pde (uint64_t *pml4, const uint64_t va, int create) {
+	uint64_t *pdpt, *pd;
+
+	pdpt = next_table (&pml4[PML4 (va)], create);
+	if (pdpt == NULL || (pdpt[PDPE (va)] & PTE_PS))
+		return NULL;
+	pd = next_table (&pdpt[PDPE (va)], create);
+	return pd != NULL ? &pd[PDX (va)] : NULL;
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -100,59 +213,64 @@ pml4_create (void) {
 	return pml4;
 }
 
-static bool
-pt_for_each (uint64_t *pt, pte_for_each_func *func, void *aux,
-		unsigned pml4_index, unsigned pdp_index, unsigned pdx_index) {
-	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
-		uint64_t *pte = &pt[i];
-		if (((uint64_t) *pte) & PTE_P) {
-			void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
-								 ((uint64_t) pdp_index << PDPESHIFT) |
-								 ((uint64_t) pdx_index << PDXSHIFT) |
-								 ((uint64_t) i << PTXSHIFT));
-			if (!func (pte, va, aux))
-				return false;
-		}
-	}
-	return true;
-}
+/* Bits of a virtual address that must copy bit 47. */
+#define VA_SIGN_EXTEND 0xffff000000000000ULL
 
+/* Calls FUNC on each present leaf entry under TABLE, a page table
+ * structure at LEVEL (3 for a PML4, 0 for a page table) whose
+ * span starts at virtual address BASE, that maps a page
+ * overlapping [START, END).  Only the entries that overlap the
+ * range are looked at, and a non-present entry at any level skips
+ * its whole span at once.  Stops and returns false as soon as
+ * FUNC does. */
 static bool
-pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
-		unsigned pml4_index, unsigned pdp_index) {
-	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
-		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
-					pml4_index, pdp_index, i))
+range_walk (uint64_t *table, int level, uint64_t base,
+		uint64_t start, uint64_t end, pte_for_each_func *func, void *aux) {
+	unsigned shift = PTXSHIFT + 9 * level;
+	unsigned i = start > base ? (start >> shift) & 0x1FF : 0;
+
+	for (; i < PGSIZE / sizeof (uint64_t); i++) {
+		uint64_t va = base + ((uint64_t) i << shift);
+		uint64_t entry = table[i];
+
+		if (level == 3 && (va & (1ULL << 47)))
+			va |= VA_SIGN_EXTEND;
+		if (va >= end)
+			break;
+		if (!(entry & PTE_P))
+			continue;
+		if (level == 0 || (entry & PTE_PS)) {
+			if (!func (&table[i], (void *) va, aux))
 				return false;
+		} else if (!range_walk (ptov (PTE_ADDR (entry)), level - 1, va,
+					start, end, func, aux))
+			return false;
 	}
 	return true;
 }
 
-static bool
-pdp_for_each (uint64_t *pdp,
-		pte_for_each_func *func, void *aux, unsigned pml4_index) {
-	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
-		uint64_t *pde = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pde) & PTE_P)
-			if (!pgdir_for_each ((uint64_t *) PTE_ADDR (pde), func,
-					 aux, pml4_index, i))
-				return false;
-	}
-	return true;
+/* Apply FUNC to each present pte entry of PML4 that maps a page
+ * overlapping [START, END), in order of address.  A large page is
+ * passed as the page directory (pointer) entry that maps it,
+ * which has PTE_PS set.  The walk costs time in proportion to the
+ * part of the range that is actually mapped: empty upper-level
+ * entries are skipped whole.  Stops and returns false as soon as
+ * FUNC does; otherwise returns true. */
+bool
+pml4_for_each_range (uint64_t *pml4, const void *start, const void *end,
+		pte_for_each_func *func, void *aux) {
+	if ((uint64_t) start >= (uint64_t) end)
+		return true;
+	return range_walk (pml4, 3, 0, (uint64_t) start, (uint64_t) end,
+			func, aux);
 }
 
-/* Apply FUNC to each available pte entries including kernel's. */
+/* Apply FUNC to each available pte entries including kernel's.
+ * A large page is passed as the page directory (pointer) entry
+ * that maps it, which has PTE_PS set. */
 bool
 pml4_for_each (uint64_t *pml4, pte_for_each_func *func, void *aux) {
-	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
-		uint64_t *pdpe = ptov((uint64_t *) pml4[i]);
-		if (((uint64_t) pdpe) & PTE_P)
-			if (!pdp_for_each ((uint64_t *) PTE_ADDR (pdpe), func, aux, i))
-				return false;
-	}
-	return true;
+	return range_walk (pml4, 3, 0, 0, UINT64_MAX, func, aux);
 }
 
 static void
@@ -169,7 +287,12 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		if (!(((uint64_t) pte) & PTE_P))
+			continue;
+		if (((uint64_t) pte) & PTE_PS)
+			palloc_free_multiple ((void *) PTE_ADDR (pte),
+					LARGE_PGSIZE / PGSIZE);
+		else
 			pt_destroy (PTE_ADDR (pte));
 	}
 	palloc_free_page ((void *) pdp);
@@ -191,6 +314,10 @@ pml4_destroy (uint64_t *pml4) {
 	if (pml4 == NULL)
 		return;
 	ASSERT (pml4 != base_pml4);
+	ASSERT (!is_active (pml4));
+
+	if (pcid_enabled)
+		pcid_forget (pml4);
 
 	/* if PML4 (vaddr) >= 1, it's kernel space by define. */
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
@@ -199,11 +326,208 @@ pml4_destroy (uint64_t *pml4) {
 	palloc_free_page ((void *) pml4);
 }
 
+/* Turns on global pages and PCIDs, if the CPU supports them.
+ * Must be called before the first pml4_activate(). */
+void
+mmu_init (void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid (1, 0, &eax, &ebx, &ecx, &edx);
+	if (edx & CPUID_EDX_PGE)
+		lcr4 (rcr4 () | CR4_PGE);
+	if (ecx & CPUID_ECX_PCID) {
+		/* Setting CR4.PCIDE requires the current PCID to be 0. */
+		ASSERT ((rcr3 () & PGMASK) == 0);
+		lcr4 (rcr4 () | CR4_PCIDE);
+		pcid_enabled = true;
+	}
+}
+
+/* Returns the PCID and CR3_NOFLUSH bits to load PML4 with on
+ * this CPU, giving PML4 a PCID if it has none.  Interrupts must
+ * be off. */
+static uint64_t
+pcid_get (uint64_t *pml4) {
+	struct mmu_cpu *pc = &mmu_cpus[cpu_id ()];
+	unsigned i;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	/* base_pml4 has no user mappings to keep, and flushing PCID 0
+	 * also gets rid of whatever the boot page tables left. */
+	if (pml4 == base_pml4)
+		return 0;
+
+	for (i = 0; i < PCID_CNT; i++)
+		if (pc->owner[i] == pml4) {
+			if (!pc->stale[i]) {
+				pc->hits++;
+				return (i + 1) | CR3_NOFLUSH;
+			}
+			pc->stale[i] = false;
+			pc->stale_flushes++;
+			return i + 1;
+		}
+
+	i = pc->next;
+	pc->next = (i + 1) % PCID_CNT;
+	pc->owner[i] = pml4;
+	pc->stale[i] = false;
+	pc->recycles++;
+	return i + 1;
+}
+
+/* Takes back the PCIDs of PML4 on every CPU, because PML4 is
+ * about to be freed and its page may be reused for a new page map
+ * level 4. */
+static void
+pcid_forget (uint64_t *pml4) {
+	enum intr_level old_level = intr_disable ();
+	unsigned cpu, i;
+
+	for (cpu = 0; cpu < CPU_CNT; cpu++)
+		for (i = 0; i < PCID_CNT; i++)
+			if (mmu_cpus[cpu].owner[i] == pml4)
+				mmu_cpus[cpu].owner[i] = NULL;
+	intr_set_level (old_level);
+}
+
+/* Marks MC's PCID for PML4, if it has one, stale.  Returns true
+ * if it had one. */
+static bool
+pcid_mark_stale (struct mmu_cpu *mc, uint64_t *pml4) {
+	unsigned i;
+
+	for (i = 0; i < PCID_CNT; i++)
+		if (mc->owner[i] == pml4) {
+			mc->stale[i] = true;
+			return true;
+		}
+	return false;
+}
+
+/* Returns true if PML4 is the running CPU's active page map level 4. */
+static bool
+is_active (uint64_t *pml4) {
+	return PTE_ADDR (rcr3 ()) == vtop (pml4);
+}
+
+/* Flushes the whole TLB, global entries included. */
+static void
+flush_global (void) {
+	uint64_t cr4 = rcr4 ();
+
+	if (cr4 & CR4_PGE) {
+		/* Toggling CR4.PGE flushes every entry of every PCID. */
+		lcr4 (cr4 & ~CR4_PGE);
+		lcr4 (cr4);
+	} else
+		lcr3 (rcr3 ());
+}
+
+/* Invalidates the running CPU's TLB entries for the CNT pages at
+ * VA[] in PML4, which is base_pml4 or active, or all of its
+ * entries if CNT is more than MMU_GATHER_MAX.  Interrupts must be
+ * off. */
+static void
+flush_local (uint64_t *pml4, const uint64_t *va, size_t cnt) {
+	size_t i;
+
+	if (cnt <= MMU_GATHER_MAX) {
+		for (i = 0; i < cnt; i++)
+			invlpg (va[i]);
+		pages_flushed += cnt;
+	} else {
+		if (pml4 == base_pml4)
+			flush_global ();
+		else if (pcid_enabled) {
+			/* Reloading CR3 with a stale PCID flushes it. */
+			pcid_mark_stale (&mmu_cpus[cpu_id ()], pml4);
+			pml4_activate (pml4);
+		} else
+			lcr3 (rcr3 ());
+		full_flushes++;
+	}
+}
+
+/* Invalidates the TLB entries for the CNT pages at VA[] in PML4
+ * on every CPU that may hold them, or all of PML4's entries if
+ * CNT is more than MMU_GATHER_MAX.  See the comment at the top of
+ * this file. */
+static void
+tlb_shootdown (uint64_t *pml4, const uint64_t *va, size_t cnt) {
+	enum intr_level old_level = intr_disable ();
+	unsigned self = cpu_id (), cpu;
+
+	shootdown_cnt++;
+	for (cpu = 0; cpu < CPU_CNT; cpu++) {
+		struct mmu_cpu *mc = &mmu_cpus[cpu];
+
+		if (pml4 == base_pml4 || mc->active == pml4) {
+			ASSERT (cpu == self);
+			flush_local (pml4, va, cnt);
+		} else if (pcid_enabled && pcid_mark_stale (mc, pml4)
+				&& cpu != self)
+			lazy_flushes++;
+	}
+	intr_set_level (old_level);
+}
+
+/* Invalidates the TLB entry for virtual page VA of PML4. */
+static void
+flush_page (uint64_t *pml4, const void *va) {
+	uint64_t page = (uint64_t) pg_round_down (va);
+	tlb_shootdown (pml4, &page, 1);
+}
+
+/* Invalidates every TLB entry for PML4's user mappings, on every
+ * CPU: at once where PML4 is active, elsewhere the next time it
+ * is activated. */
+void
+pml4_flush (uint64_t *pml4) {
+	tlb_shootdown (pml4, NULL, TLB_FLUSH_ALL);
+}
+
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register.  With PCIDs, entries cached from earlier runs of PML4
+ * stay valid; see the comment at the top of this file. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	enum intr_level old_level;
+
+	if (pml4 == NULL)
+		pml4 = base_pml4;
+	if (!pcid_enabled) {
+		mmu_cpus[cpu_id ()].active = pml4;
+		lcr3 (vtop (pml4));
+		return;
+	}
+
+	old_level = intr_disable ();
+	mmu_cpus[cpu_id ()].active = pml4;
+	lcr3 (vtop (pml4) | pcid_get (pml4));
+	intr_set_level (old_level);
+}
+
+/* Prints PCID and TLB flush statistics. */
+void
+mmu_print_stats (void) {
+	unsigned cpu;
+
+	if (!pcid_enabled)
+		printf ("PCID: not supported, every address space switch "
+				"flushes the TLB\n");
+	else
+		for (cpu = 0; cpu < CPU_CNT; cpu++) {
+			struct mmu_cpu *pc = &mmu_cpus[cpu];
+			printf ("PCID: cpu%u: %llu switches kept the TLB, %llu flushed "
+					"a stale PCID, %llu recycled a PCID\n",
+					cpu, pc->hits, pc->stale_flushes, pc->recycles);
+		}
+	printf ("TLB: %llu shootdowns (%llu batched unmaps): %llu pages "
+			"flushed singly, %llu full flushes, %llu lazy flushes\n",
+			shootdown_cnt, gather_cnt, pages_flushed, full_flushes,
+			lazy_flushes);
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -216,15 +540,71 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
-	if (pte && (*pte & PTE_P))
+	if (pte && (*pte & PTE_P)) {
+		if (*pte & PTE_PS)
+			return ptov (PTE_ADDR (*pte))
+				+ ((uint64_t) uaddr & (LARGE_PGSIZE - 1));
 		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+	}
 	return NULL;
 }
 
+/* If user virtual address UADDR lies in a 2 MB page of PML4,
+ * replaces the page directory entry for it with a page table
+ * that maps the same frames, with the same permissions, in 4 kB
+ * pages, so that the mapping of a single page can change.  Does
+ * nothing if UADDR is not in a 2 MB page, or is not a user
+ * address: the kernel's mappings are shared by every PML4.
+ * Returns false if no memory is left for the page table. */
+static bool
+split_large_page (uint64_t *pml4, const void *uaddr) {
+	uint64_t *pde, *pt, pa, flags;
+	unsigned i;
+
+	if (!is_user_vaddr (uaddr))
+		return true;
+	pde = pml4e_walk_pde (pml4, (uint64_t) uaddr, false);
+	if (pde == NULL || (*pde & (PTE_P | PTE_PS)) != (PTE_P | PTE_PS))
+		return true;
+
+	pt = palloc_get_page (0);
+	if (pt == NULL)
+		return false;
+	pa = PTE_ADDR (*pde);
+	flags = *pde & PTE_FLAGS & ~PTE_PS;
+	for (i = 0; i < LARGE_PGSIZE / PGSIZE; i++)
+		pt[i] = (pa + i * PGSIZE) | flags;
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+	flush_page (pml4, uaddr);
+	return true;
+}
+
+/* Maps the LARGE_PGSIZE bytes at user virtual address UPAGE in
+ * PML4 to the physically contiguous frames starting at kernel
+ * virtual address KPAGE, with a single 2 MB page.  Both
+ * addresses must be aligned to LARGE_PGSIZE, and no part of the
+ * range may be mapped yet.  Returns false if memory allocation
+ * fails, or if a page table already covers the range. */
+bool
+pml4_set_large_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	ASSERT ((uint64_t) upage % LARGE_PGSIZE == 0);
+	ASSERT (vtop (kpage) % LARGE_PGSIZE == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	uint64_t *pde = pml4e_walk_pde (pml4, (uint64_t) upage, 1);
+
+	if (pde == NULL || (*pde & PTE_P))
+		return false;
+	*pde = vtop (kpage) | PTE_PS | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+	return true;
+}
+
 /* Adds a mapping in page map level 4 PML4 from user virtual page
  * UPAGE to the physical frame identified by kernel virtual address KPAGE.
- * UPAGE must not already be mapped. KPAGE should probably be a page obtained
- * from the user pool with palloc_get_page().
+ * If UPAGE is already mapped, as when changing its permissions, the old
+ * mapping is replaced and shot down from the TLBs.  KPAGE should probably
+ * be a page obtained from the user pool with palloc_get_page().
  * If WRITABLE is true, the new page is read/write;
  * otherwise it is read-only.
  * Returns true if successful, false if memory allocation
@@ -236,29 +616,41 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 	ASSERT (is_user_vaddr (upage));
 	ASSERT (pml4 != base_pml4);
 
+	if (!split_large_page (pml4, upage))
+		return false;
+
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, 1);
 
-	if (pte)
+	if (pte) {
+		uint64_t old = *pte;
 		*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+
+		/* Replacing a mapping, or taking away write access, must
+		 * not leave the old one in any TLB. */
+		if (old & PTE_P)
+			flush_page (pml4, upage);
+	}
 	return pte != NULL;
 }
 
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
- * UPAGE need not be mapped. */
+ * UPAGE need not be mapped.  A 2 MB page that holds UPAGE is
+ * split first; if that fails for lack of memory, the whole 2 MB
+ * page is marked not present instead. */
 void
 pml4_clear_page (uint64_t *pml4, void *upage) {
 	uint64_t *pte;
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (is_user_vaddr (upage));
 
+	split_large_page (pml4, upage);
 	pte = pml4e_walk (pml4, (uint64_t) upage, false);
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+		flush_page (pml4, upage);
 	}
 }
 
@@ -273,7 +665,9 @@ pml4_is_dirty (uint64_t *pml4, const void *vpage) {
 }
 
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
- * in PML4. */
+ * in PML4.  If VPAGE lies in a 2 MB page, the bit is the one in
+ * its page directory entry, which stands for all of its pages:
+ * the mapping is not split. */
 void
 pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
@@ -281,10 +675,9 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 		if (dirty)
 			*pte |= PTE_D;
 		else
-			*pte &= ~(uint32_t) PTE_D;
+			*pte &= ~(uint64_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		flush_page (pml4, vpage);
 	}
 }
 
@@ -299,7 +692,9 @@ pml4_is_accessed (uint64_t *pml4, const void *vpage) {
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
-   VPAGE in PD. */
+ * VPAGE in PD.  As with pml4_set_dirty(), a 2 MB page keeps a
+ * single bit for all of its pages, so that the scans of the
+ * eviction policies do not split it. */
 void
 pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
@@ -307,9 +702,101 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		if (accessed)
 			*pte |= PTE_A;
 		else
-			*pte &= ~(uint32_t) PTE_A;
+			*pte &= ~(uint64_t) PTE_A;
+
+		flush_page (pml4, vpage);
+	}
+}
+
+/* Gives or takes away write access to user virtual page VPAGE in
+ * PML4, keeping the rest of its PTE, the accessed and dirty bits
+ * included.  Does nothing if VPAGE is not mapped.  Returns false
+ * if a 2 MB page that holds VPAGE could not be split. */
+bool
+pml4_set_writable (uint64_t *pml4, const void *vpage, bool writable) {
+	uint64_t *pte;
+
+	if (!split_large_page (pml4, vpage))
+		return false;
+	pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	if (pte) {
+		if (writable)
+			*pte |= PTE_W;
+		else
+			*pte &= ~(uint64_t) PTE_W;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		flush_page (pml4, vpage);
 	}
+	return true;
+}
+
+/* Batched TLB invalidation.
+
+   Tearing down many mappings one pml4_clear_page() at a time
+   costs an invlpg each.  Instead, a caller that changes many
+   mappings of one address space at once, such as process exit
+   or vfree(), starts an mmu_gather, clears PTEs through it, and
+   finishes it.  Finishing makes a single tlb_shootdown() for the
+   whole batch, which invalidates the collected pages one by
+   one, or flushes the whole address space once there are more
+   than MMU_GATHER_MAX of them.
+
+   Pages whose mappings are torn down must not be reused while
+   the TLB may still map them, so they are handed to
+   mmu_gather_free_page() and freed only after the flush.  Until
+   then, each is linked into a list through its first bytes. */
+
+/* Starts a batch of changes to PML4, which may be base_pml4 for
+ * changes to kernel mappings. */
+void
+mmu_gather_init (struct mmu_gather *tlb, uint64_t *pml4) {
+	tlb->pml4 = pml4;
+	tlb->cnt = 0;
+	list_init (&tlb->free_pages);
+}
+
+/* Records that the TLB entry for the page at VA must go. */
+void
+mmu_gather_add (struct mmu_gather *tlb, const void *va) {
+	if (tlb->cnt < MMU_GATHER_MAX)
+		tlb->va[tlb->cnt] = (uint64_t) pg_round_down (va);
+	tlb->cnt++;
+}
+
+/* Like pml4_clear_page(), but leaves invalidating the TLB entry
+ * for UPAGE to mmu_gather_finish(). */
+void
+mmu_gather_clear_page (struct mmu_gather *tlb, void *upage) {
+	uint64_t *pte;
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (is_user_vaddr (upage));
+
+	split_large_page (tlb->pml4, upage);
+	pte = pml4e_walk (tlb->pml4, (uint64_t) upage, false);
+	if (pte != NULL && (*pte & PTE_P) != 0) {
+		*pte &= ~PTE_P;
+		mmu_gather_add (tlb, upage);
+	}
+}
+
+/* Frees PAGE, a page from palloc_get_page(), once the batch has
+ * been flushed. */
+void
+mmu_gather_free_page (struct mmu_gather *tlb, void *page) {
+	ASSERT (pg_ofs (page) == 0);
+	list_push_back (&tlb->free_pages, page);
+}
+
+/* Flushes the TLB entries collected in TLB, then frees the
+ * pages collected.  TLB may be reused afterward. */
+void
+mmu_gather_finish (struct mmu_gather *tlb) {
+	if (tlb->cnt > 0)
+		tlb_shootdown (tlb->pml4, tlb->va, tlb->cnt);
+	gather_cnt++;
+	tlb->cnt = 0;
+
+	while (!list_empty (&tlb->free_pages))
+		palloc_free_page (list_pop_front (&tlb->free_pages));
 }
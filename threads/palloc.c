@@ -1,15 +1,19 @@
 #include "threads/palloc.h"
-#include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/cpu.h"
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
+#include "threads/pte.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -24,24 +28,126 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is a binary buddy allocator.  Free memory is kept as
+   blocks of 2**ORDER pages, each aligned to its own size
+   relative to the pool base, on one free list per order.  An
+   allocation of N pages takes the smallest block of at least N
+   pages, splitting larger blocks in half as needed and handing
+   back any pages beyond N.  Freeing a block merges it with its
+   "buddy", the other half of the next larger block, for as long
+   as the buddy is free too.  Both operations take O(log n)
+   time in the size of the pool.
+
+   Single pages, by far the most common request, are served from
+   a small per-CPU cache in front of each pool.  A cache is only
+   touched by its own CPU with interrupts disabled, so the common
+   case takes no lock.  An empty cache is refilled, and a full one
+   drained, PCP_BATCH pages at a time under the pool lock.  Pages
+   sitting in a cache count as allocated to the buddy allocator,
+   so a multi-page request that fails drains the caches and tries
+   again.
+
+   Pages may be freed with interrupts off, where taking the pool
+   lock is not allowed: do_schedule() frees the pages of dying
+   threads that way.  Such a free never drains a cache.  If it
+   cannot go to a cache, the pages wait on a list of deferred frees
+   in the pool.  The next thread to take the pool lock frees
+   them.
+
+   Each pool also keeps a stack of pages that are already zeroed,
+   for PAL_ZERO requests.  When the CPU goes idle, the idle thread
+   wakes a kernel thread that refills the stacks one page at a
+   time.  That thread stops as soon as any other thread is ready
+   to run, so zeroing only takes time the CPU would otherwise
+   spend halted.  A pool that is out of memory falls back on its
+   zeroed pages for any request. */
+
+/* Largest block order kept on a free list.  2**MAX_ORDER pages
+   is more than any pool Pintos boots with. */
+#define MAX_ORDER 20
+
+/* Per-page state in a pool's page_info[].  A page that starts a
+   free block holds PAGE_FREE | the block's order.  A page handed
+   out by palloc_get_*() holds PAGE_USED, so that freeing a page
+   that is not allocated is caught.  Every other page holds 0. */
+#define PAGE_FREE 0x80
+#define PAGE_USED 0x40
+#define PAGE_ORDER_MASK 0x3f
+
+/* Capacity of a per-CPU page cache, and the number of pages
+   moved between a cache and its pool at once. */
+#define PCP_HIGH 64
+#define PCP_BATCH 16
+
+/* A per-CPU cache of free single pages. */
+struct pcp_cache {
+	size_t cnt;                     /* Number of cached pages. */
+	void *pages[PCP_HIGH];          /* Cached pages, hottest last. */
+	uint64_t alloc_hits;            /* Allocations served by the cache. */
+	uint64_t alloc_misses;          /* Allocations that had to refill. */
+	uint64_t free_hits;             /* Frees absorbed by the cache. */
+	uint64_t free_misses;           /* Frees that had to drain. */
+};
+
+/* Capacity of a pool's stack of pre-zeroed pages. */
+#define ZERO_HIGH 64
 
 /* A memory pool. */
 struct pool {
 	struct lock lock;               /* Mutual exclusion. */
-	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+	size_t page_cnt;                /* Number of pages in pool. */
+	uint8_t *page_info;             /* Per-page state, see PAGE_FREE. */
+	struct list free_lists[MAX_ORDER + 1]; /* Free blocks by order. */
+	struct list deferred;           /* Deferred frees, with interrupts off. */
+	struct pcp_cache pcp[CPU_CNT];  /* Per-CPU single page caches. */
+
+	/* Pre-zeroed pages.  Accessed with interrupts off. */
+	size_t zero_cnt;                /* Number of zeroed pages. */
+	void *zero_pages[ZERO_HIGH];    /* Zeroed pages. */
+	uint64_t zero_hits;             /* PAL_ZERO requests served from them. */
+	uint64_t zero_misses;           /* PAL_ZERO requests zeroed on demand. */
+};
+
+/* A free block, stored in its own first page. */
+struct free_block {
+	struct list_elem elem;          /* Element in free_lists[order]. */
+};
+
+/* A run of pages whose free was deferred, stored in its own first
+   page. */
+struct deferred_free {
+	struct list_elem elem;          /* Element in the pool's deferred. */
+	size_t page_cnt;                /* Number of pages. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* Wakes the zeroing thread, and whether it has been woken since
+   it last started a refill.  Accessed with interrupts off. */
+static struct semaphore zero_sema;
+static bool zero_wake_pending;
+
 /* Maximum number of pages to put in user pool. */
 size_t user_page_limit = SIZE_MAX;
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static void pool_lock (struct pool *);
+static void set_used (struct pool *, void *pages, size_t page_cnt,
+		bool used);
+static size_t pool_alloc (struct pool *, size_t page_cnt);
+static size_t pool_alloc_aligned (struct pool *, int order);
+static void pool_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void *pcp_alloc (struct pool *);
+static void pcp_free (struct pool *, void *page);
+static bool pcp_drain_all (struct pool *);
+static void *zero_pop (struct pool *, enum palloc_flags);
+static bool zero_drain (struct pool *);
 
 /* multiboot info */
 struct multiboot_info {
@@ -219,16 +325,16 @@ split:
 			else
 				NOT_REACHED ();
 
-			pool_end = pool->base + bitmap_size (pool->used_map) * PGSIZE;
+			pool_end = pool->base + pool->page_cnt * PGSIZE;
 			page_idx = pg_no (start) - pg_no (pool->base);
 			if ((uint64_t) pool_end < end) {
 				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				pool_free (pool, page_idx, page_cnt);
 				start = (uint64_t) pool_end;
 				goto split;
 			} else {
 				page_cnt = ((uint64_t) end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				pool_free (pool, page_idx, page_cnt);
 			}
 		}
 	}
@@ -250,6 +356,7 @@ palloc_init (void) {
 	printf ("\text_mem: 0x%llx ~ 0x%llx (Usable: %'llu kB)\n",
 		  ext_mem.start, ext_mem.end, ext_mem.size / 1024);
 	populate_pools (&base_mem, &ext_mem);
+	sema_init (&zero_sema, 0);
 	return ext_mem.end;
 }
 
@@ -262,19 +369,36 @@ palloc_init (void) {
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t page_idx = SIZE_MAX;
+	void *pages = NULL;
+	bool zeroed = false;
 
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
-	void *pages;
-
-	if (page_idx != BITMAP_ERROR)
-		pages = pool->base + PGSIZE * page_idx;
-	else
-		pages = NULL;
+	if (page_cnt == 1) {
+		if (flags & PAL_ZERO)
+			pages = zero_pop (pool, flags);
+		if (pages == NULL)
+			pages = pcp_alloc (pool);
+		else
+			zeroed = true;
+
+		/* Out of memory: settle for a page we zeroed in advance. */
+		if (pages == NULL && !(flags & PAL_ZERO))
+			pages = zero_pop (pool, flags);
+	} else if (page_cnt > 1) {
+		do {
+			pool_lock (pool);
+			page_idx = pool_alloc (pool, page_cnt);
+			lock_release (&pool->lock);
+		} while (page_idx == SIZE_MAX
+				&& (pcp_drain_all (pool) || zero_drain (pool)));
+
+		if (page_idx != SIZE_MAX)
+			pages = pool->base + PGSIZE * page_idx;
+	}
 
 	if (pages) {
-		if (flags & PAL_ZERO)
+		set_used (pool, pages, page_cnt, true);
+		if ((flags & PAL_ZERO) && !zeroed)
 			memset (pages, 0, PGSIZE * page_cnt);
 	} else {
 		if (flags & PAL_ASSERT)
@@ -284,6 +408,37 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	return pages;
 }
 
+/* Obtains LARGE_PGSIZE / PGSIZE contiguous free pages whose
+   physical address is a multiple of LARGE_PGSIZE, so that they
+   can be mapped with a single 2 MB page.  FLAGS are as for
+   palloc_get_multiple().
+
+   A huge page is only worth having if one is free, so unlike
+   palloc_get_multiple() this does not drain the page caches to
+   make one: callers are expected to fall back on single pages. */
+void *
+palloc_get_huge (enum palloc_flags flags) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t page_idx;
+	void *pages;
+
+	pool_lock (pool);
+	page_idx = pool_alloc_aligned (pool, PDXSHIFT - PGBITS);
+	lock_release (&pool->lock);
+
+	if (page_idx == SIZE_MAX) {
+		if (flags & PAL_ASSERT)
+			PANIC ("palloc_get_huge: out of pages");
+		return NULL;
+	}
+
+	pages = pool->base + PGSIZE * page_idx;
+	set_used (pool, pages, LARGE_PGSIZE / PGSIZE, true);
+	if (flags & PAL_ZERO)
+		memset (pages, 0, LARGE_PGSIZE);
+	return pages;
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -296,7 +451,9 @@ palloc_get_page (enum palloc_flags flags) {
 	return palloc_get_multiple (flags, 1);
 }
 
-/* Frees the PAGE_CNT pages starting at PAGES. */
+/* Frees the PAGE_CNT pages starting at PAGES.  May be called
+   with interrupts off, as from the scheduler: it then never
+   sleeps. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) {
 	struct pool *pool;
@@ -318,8 +475,328 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 #ifndef NDEBUG
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
-	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	ASSERT (page_idx + page_cnt <= pool->page_cnt);
+	set_used (pool, pages, page_cnt, false);
+
+	if (page_cnt == 1)
+		pcp_free (pool, pages);
+	else if (intr_get_level () == INTR_OFF) {
+		struct deferred_free *d = pages;
+
+		d->page_cnt = page_cnt;
+		list_push_back (&pool->deferred, &d->elem);
+	} else {
+		pool_lock (pool);
+		pool_free (pool, page_idx, page_cnt);
+		lock_release (&pool->lock);
+	}
+}
+
+/* Sets or clears PAGE_USED on the PAGE_CNT pages at PAGES in
+   POOL, and checks that none of them had it already, or that all
+   of them had it, respectively. */
+static void
+set_used (struct pool *pool, void *pages, size_t page_cnt, bool used) {
+	size_t page_idx = pg_no (pages) - pg_no (pool->base);
+	size_t i;
+
+	for (i = page_idx; i < page_idx + page_cnt; i++) {
+		ASSERT (((pool->page_info[i] & PAGE_USED) != 0) != used);
+		pool->page_info[i] ^= PAGE_USED;
+	}
+}
+
+/* Acquires POOL's lock, then frees the runs of pages whose frees
+   were deferred because interrupts were off. */
+static void
+pool_lock (struct pool *pool) {
+	lock_acquire (&pool->lock);
+	for (;;) {
+		struct deferred_free *d = NULL;
+		enum intr_level old_level = intr_disable ();
+
+		if (!list_empty (&pool->deferred))
+			d = list_entry (list_pop_front (&pool->deferred),
+					struct deferred_free, elem);
+		intr_set_level (old_level);
+		if (d == NULL)
+			break;
+		pool_free (pool, pg_no (d) - pg_no (pool->base), d->page_cnt);
+	}
+}
+
+/* Returns the CNT pages in PAGES to POOL. */
+static void
+pool_free_pages (struct pool *pool, void **pages, size_t cnt) {
+	size_t i;
+
+	pool_lock (pool);
+	for (i = 0; i < cnt; i++)
+		pool_free (pool, pg_no (pages[i]) - pg_no (pool->base), 1);
+	lock_release (&pool->lock);
+}
+
+/* Allocates a single page from the running CPU's cache in
+   front of POOL, refilling the cache from POOL if it is empty.
+   Returns a null pointer if POOL is out of pages. */
+static void *
+pcp_alloc (struct pool *pool) {
+	void *batch[PCP_BATCH];
+	struct pcp_cache *pcp;
+	enum intr_level old_level;
+	size_t cnt, i;
+	void *page;
+
+	old_level = intr_disable ();
+	pcp = &pool->pcp[cpu_id ()];
+	if (pcp->cnt > 0) {
+		pcp->alloc_hits++;
+		page = pcp->pages[--pcp->cnt];
+		intr_set_level (old_level);
+		return page;
+	}
+	pcp->alloc_misses++;
+	intr_set_level (old_level);
+
+	/* Grab a batch from the pool.  Interrupts must be back on
+	   here, since acquiring the lock may sleep. */
+	pool_lock (pool);
+	for (cnt = 0; cnt < PCP_BATCH; cnt++) {
+		size_t page_idx = pool_alloc (pool, 1);
+		if (page_idx == SIZE_MAX)
+			break;
+		batch[cnt] = pool->base + PGSIZE * page_idx;
+	}
+	lock_release (&pool->lock);
+	if (cnt == 0)
+		return NULL;
+
+	/* Keep one page and cache the rest.  We may have been
+	   preempted by another thread that filled the cache in the
+	   meantime, in which case the excess goes straight back. */
+	page = batch[--cnt];
+	old_level = intr_disable ();
+	pcp = &pool->pcp[cpu_id ()];
+	for (i = 0; i < cnt && pcp->cnt < PCP_HIGH; i++)
+		pcp->pages[pcp->cnt++] = batch[i];
+	intr_set_level (old_level);
+
+	if (i < cnt)
+		pool_free_pages (pool, batch + i, cnt - i);
+	return page;
+}
+
+/* Frees PAGE into the running CPU's cache in front of POOL.  If
+   the cache is full, its PCP_BATCH least recently freed pages
+   are returned to POOL first, unless interrupts are off. */
+static void
+pcp_free (struct pool *pool, void *page) {
+	void *batch[PCP_BATCH];
+	struct pcp_cache *pcp;
+	enum intr_level old_level;
+
+	old_level = intr_disable ();
+	pcp = &pool->pcp[cpu_id ()];
+	if (pcp->cnt < PCP_HIGH) {
+		pcp->free_hits++;
+		pcp->pages[pcp->cnt++] = page;
+		intr_set_level (old_level);
+		return;
+	}
+	pcp->free_misses++;
+	if (old_level == INTR_OFF) {
+		/* The caller cannot sleep, so leave PAGE for the next
+		   thread that takes the pool lock. */
+		struct deferred_free *d = page;
+
+		d->page_cnt = 1;
+		list_push_back (&pool->deferred, &d->elem);
+		return;
+	}
+	memcpy (batch, pcp->pages, sizeof batch);
+	memmove (pcp->pages, pcp->pages + PCP_BATCH,
+			sizeof *pcp->pages * (PCP_HIGH - PCP_BATCH));
+	pcp->cnt -= PCP_BATCH;
+	pcp->pages[pcp->cnt++] = page;
+	intr_set_level (old_level);
+
+	pool_free_pages (pool, batch, PCP_BATCH);
+}
+
+/* Returns every page cached in front of POOL to POOL, so that
+   they can coalesce into larger blocks.  Returns true if any
+   page was returned.  With a single CPU, the caches of other
+   CPUs are never in use, so this is safe. */
+static bool
+pcp_drain_all (struct pool *pool) {
+	bool drained = false;
+	unsigned cpu;
+
+	for (cpu = 0; cpu < CPU_CNT; cpu++) {
+		struct pcp_cache *pcp = &pool->pcp[cpu];
+		void *batch[PCP_BATCH];
+		enum intr_level old_level;
+		size_t cnt;
+
+		do {
+			old_level = intr_disable ();
+			cnt = pcp->cnt < PCP_BATCH ? pcp->cnt : PCP_BATCH;
+			pcp->cnt -= cnt;
+			memcpy (batch, pcp->pages + pcp->cnt, sizeof *batch * cnt);
+			intr_set_level (old_level);
+
+			if (cnt > 0) {
+				pool_free_pages (pool, batch, cnt);
+				drained = true;
+			}
+		} while (cnt > 0);
+	}
+	return drained;
+}
+
+/* Pops a page off POOL's stack of zeroed pages and returns it,
+   or returns a null pointer if the stack is empty.  FLAGS are
+   those of the request; only PAL_ZERO requests count toward the
+   stack's hit rate. */
+static void *
+zero_pop (struct pool *pool, enum palloc_flags flags) {
+	enum intr_level old_level;
+	void *page = NULL;
+
+	old_level = intr_disable ();
+	if (pool->zero_cnt > 0)
+		page = pool->zero_pages[--pool->zero_cnt];
+	if (flags & PAL_ZERO) {
+		if (page != NULL)
+			pool->zero_hits++;
+		else
+			pool->zero_misses++;
+	}
+	intr_set_level (old_level);
+
+	return page;
+}
+
+/* Returns every zeroed page of POOL to POOL.  Returns true if
+   there were any. */
+static bool
+zero_drain (struct pool *pool) {
+	void *pages[ZERO_HIGH];
+	enum intr_level old_level;
+	size_t cnt;
+
+	old_level = intr_disable ();
+	cnt = pool->zero_cnt;
+	memcpy (pages, pool->zero_pages, sizeof *pages * cnt);
+	pool->zero_cnt = 0;
+	intr_set_level (old_level);
+
+	pool_free_pages (pool, pages, cnt);
+	return cnt > 0;
+}
+
+/* Zeroes pages for POOL's stack until it is full, POOL runs out
+   of memory, or another thread is ready to run. */
+static void
+zero_refill (struct pool *pool) {
+	for (;;) {
+		enum intr_level old_level;
+		void *page;
+		bool full;
+
+		old_level = intr_disable ();
+		full = pool->zero_cnt >= ZERO_HIGH;
+		intr_set_level (old_level);
+		if (full || thread_others_ready ())
+			return;
+
+		page = pcp_alloc (pool);
+		if (page == NULL)
+			return;
+		memset (page, 0, PGSIZE);
+
+		old_level = intr_disable ();
+		if (pool->zero_cnt < ZERO_HIGH) {
+			pool->zero_pages[pool->zero_cnt++] = page;
+			page = NULL;
+		}
+		intr_set_level (old_level);
+
+		if (page != NULL) {
+			pcp_free (pool, page);
+			return;
+		}
+	}
+}
+
+/* Zeroing thread.  Refills both pools' stacks of zeroed pages
+   whenever palloc_idle() wakes it. */
+static void
+zero_daemon (void *aux UNUSED) {
+	for (;;) {
+		sema_down (&zero_sema);
+		zero_wake_pending = false;
+		zero_refill (&kernel_pool);
+		zero_refill (&user_pool);
+	}
+}
+
+/* Fills the stacks of zeroed pages and starts the thread that
+   keeps them filled.  Must be called after thread_start(). */
+void
+palloc_start_zeroing (void) {
+	zero_refill (&kernel_pool);
+	zero_refill (&user_pool);
+	thread_create ("pagezero", PRI_MIN, zero_daemon, NULL);
+}
+
+/* Called by the idle thread, with interrupts off, before it halts
+   the CPU.  Wakes the zeroing thread if a stack of zeroed pages
+   is not full.  The zeroing thread then runs once the CPU is
+   next idle, after the interrupt that ends the halt. */
+void
+palloc_idle (void) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (!zero_wake_pending && (kernel_pool.zero_cnt < ZERO_HIGH
+				|| user_pool.zero_cnt < ZERO_HIGH)) {
+		zero_wake_pending = true;
+		sema_up (&zero_sema);
+	}
+}
+
+/* Prints the hit rates of the per-CPU caches of POOL, which is
+   called NAME, and of its stack of zeroed pages. */
+static void
+pool_print_stats (const char *name, struct pool *pool) {
+	uint64_t zeroed;
+	unsigned cpu;
+
+	for (cpu = 0; cpu < CPU_CNT; cpu++) {
+		struct pcp_cache *pcp = &pool->pcp[cpu];
+		uint64_t allocs = pcp->alloc_hits + pcp->alloc_misses;
+		uint64_t frees = pcp->free_hits + pcp->free_misses;
+
+		printf ("Palloc: %s cpu%u: %llu of %llu allocs (%llu%%), "
+				"%llu of %llu frees (%llu%%) hit the page cache\n",
+				name, cpu,
+				pcp->alloc_hits, allocs,
+				allocs ? pcp->alloc_hits * 100 / allocs : 0,
+				pcp->free_hits, frees,
+				frees ? pcp->free_hits * 100 / frees : 0);
+	}
+
+	zeroed = pool->zero_hits + pool->zero_misses;
+	printf ("Palloc: %s: %llu of %llu zeroed allocs (%llu%%) were zeroed "
+			"in advance\n", name, pool->zero_hits, zeroed,
+			zeroed ? pool->zero_hits * 100 / zeroed : 0);
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	pool_print_stats ("kernel", &kernel_pool);
+	pool_print_stats ("user", &user_pool);
 }
 
 /* Frees the page at PAGE. */
@@ -331,20 +808,25 @@ palloc_free_page (void *page) {
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
+  /* We'll put the pool's page_info at BM_BASE.
+     Calculate the space needed for it and advance BM_BASE past
+     it. */
 	uint64_t pgcnt = (end - start) / PGSIZE;
-	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
+	size_t info_bytes = ROUND_UP (pgcnt, PGSIZE);
+	int order;
 
 	lock_init(&p->lock);
-	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
 	p->base = (void *) start;
+	p->page_cnt = pgcnt;
+	p->page_info = *bm_base;
+	for (order = 0; order <= MAX_ORDER; order++)
+		list_init (&p->free_lists[order]);
+	list_init (&p->deferred);
 
-	// Mark all to unusable.
-	bitmap_set_all(p->used_map, true);
+	// Mark all to unusable.  populate_pools() frees the usable parts.
+	memset (p->page_info, 0, pgcnt);
 
-	*bm_base += bm_pages;
+	*bm_base += info_bytes;
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -353,6 +835,142 @@ static bool
 page_from_pool (const struct pool *pool, void *page) {
 	size_t page_no = pg_no (page);
 	size_t start_page = pg_no (pool->base);
-	size_t end_page = start_page + bitmap_size (pool->used_map);
+	size_t end_page = start_page + pool->page_cnt;
 	return page_no >= start_page && page_no < end_page;
 }
+
+/* Returns the free block that starts at page PAGE_IDX of POOL. */
+static struct free_block *
+idx_to_block (const struct pool *pool, size_t page_idx) {
+	return (struct free_block *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Returns the smallest ORDER such that 2**ORDER >= PAGE_CNT. */
+static int
+order_for (size_t page_cnt) {
+	int order = 0;
+	while (((size_t) 1 << order) < page_cnt)
+		order++;
+	return order;
+}
+
+/* Puts the free block of 2**ORDER pages at PAGE_IDX on POOL's
+   free list for ORDER. */
+static void
+push_block (struct pool *pool, size_t page_idx, int order) {
+	pool->page_info[page_idx] = PAGE_FREE | order;
+	list_push_front (&pool->free_lists[order],
+			&idx_to_block (pool, page_idx)->elem);
+}
+
+/* Takes the free block at PAGE_IDX off its free list. */
+static void
+pop_block (struct pool *pool, size_t page_idx) {
+	pool->page_info[page_idx] = 0;
+	list_remove (&idx_to_block (pool, page_idx)->elem);
+}
+
+/* Frees the block of 2**ORDER pages at PAGE_IDX in POOL,
+   merging it with its buddies for as long as they are free. */
+static void
+free_block (struct pool *pool, size_t page_idx, int order) {
+	ASSERT (page_idx % ((size_t) 1 << order) == 0);
+
+	while (order < MAX_ORDER) {
+		size_t buddy = page_idx ^ ((size_t) 1 << order);
+		if (buddy >= pool->page_cnt
+				|| pool->page_info[buddy] != (PAGE_FREE | order))
+			break;
+		pop_block (pool, buddy);
+		if (buddy < page_idx)
+			page_idx = buddy;
+		order++;
+	}
+	push_block (pool, page_idx, order);
+}
+
+/* Frees the PAGE_CNT pages starting at PAGE_IDX in POOL, which
+   need not form a single block: the range is split into the
+   largest aligned blocks that fit.  POOL's lock must be held,
+   except while the pools are being populated at boot. */
+static void
+pool_free (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	while (page_cnt > 0) {
+		int order = 0;
+
+		while (order < MAX_ORDER
+				&& page_idx % ((size_t) 2 << order) == 0
+				&& ((size_t) 2 << order) <= page_cnt)
+			order++;
+
+		ASSERT (pool->page_info[page_idx] == 0);
+		free_block (pool, page_idx, order);
+		page_idx += (size_t) 1 << order;
+		page_cnt -= (size_t) 1 << order;
+	}
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first one, or SIZE_MAX if no free block is large
+   enough.  POOL's lock must be held. */
+static size_t
+pool_alloc (struct pool *pool, size_t page_cnt) {
+	int order = order_for (page_cnt);
+	int avail;
+	size_t page_idx;
+
+	/* Find the smallest block that is large enough. */
+	for (avail = order; avail <= MAX_ORDER; avail++)
+		if (!list_empty (&pool->free_lists[avail]))
+			break;
+	if (avail > MAX_ORDER)
+		return SIZE_MAX;
+
+	page_idx = pg_no (list_front (&pool->free_lists[avail]))
+		- pg_no (pool->base);
+	pop_block (pool, page_idx);
+
+	/* Split it down to the requested order, freeing the upper
+	   halves. */
+	while (avail > order) {
+		avail--;
+		push_block (pool, page_idx + ((size_t) 1 << avail), avail);
+	}
+
+	/* Hand back the pages past PAGE_CNT in the last block. */
+	if (((size_t) 1 << order) > page_cnt)
+		pool_free (pool, page_idx + page_cnt,
+				((size_t) 1 << order) - page_cnt);
+	return page_idx;
+}
+
+/* Allocates 2**ORDER contiguous pages from POOL whose physical
+   address is a multiple of 2**ORDER pages, and returns the
+   index of the first one, or SIZE_MAX if there is no such run.
+   POOL's lock must be held.
+
+   Buddy blocks are aligned relative to the pool base, which
+   need not be aligned itself.  If it is not, a block twice the
+   size always holds an aligned run; the pages on either side of
+   the run are freed again. */
+static size_t
+pool_alloc_aligned (struct pool *pool, int order) {
+	size_t align = (size_t) 1 << order;
+	size_t base_no = pg_no (pool->base);
+	int need = base_no % align == 0 ? order : order + 1;
+	size_t page_idx, start, end;
+
+	if (need > MAX_ORDER)
+		return SIZE_MAX;
+	page_idx = pool_alloc (pool, (size_t) 1 << need);
+	if (page_idx == SIZE_MAX)
+		return SIZE_MAX;
+
+	start = page_idx + (align - (base_no + page_idx) % align) % align;
+	end = page_idx + ((size_t) 1 << need);
+	if (start > page_idx)
+		pool_free (pool, page_idx, start - page_idx);
+	if (end > start + align)
+		pool_free (pool, start + align, end - (start + align));
+	return start;
+}
@@ -0,0 +1,361 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Slab allocator for fixed-size objects.
+
+   Each kmem_cache hands out objects of one size.  Objects are
+   carved out of "slabs", single pages obtained from the page
+   allocator.  A slab starts with a header and a stack of the
+   indices of its free objects, followed by the objects
+   themselves.  Unlike malloc(), a cache never rounds the object
+   size up to a power of 2, so a 560-byte inode takes 560 bytes
+   rather than 1 kB.
+
+   If a cache has a constructor, it is run on every object once,
+   when the object's slab is created.  Objects must be freed back
+   in their constructed state, so that kmem_cache_alloc() can
+   hand them out again without running the constructor.
+
+   Most slabs have some space left over after their last object.
+   Successive slabs shift their objects by one cache line more
+   within that space ("coloring"), so that objects at the same
+   index in different slabs don't all compete for the same
+   cache sets.
+
+   Allocation and freeing normally go through a per-CPU
+   "magazine", a small stack of objects that the running CPU
+   accesses with interrupts off and without taking the cache
+   lock.  An empty magazine is refilled, and a full one flushed,
+   MAG_BATCH objects at a time under the cache lock.  Objects in
+   magazines count as allocated as far as the slabs are
+   concerned.  Like malloc(), none of this may be used from an
+   interrupt handler. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab0bec
+
+/* Coloring granularity: the size of a cache line. */
+#define CACHE_LINE 64
+
+/* Capacity of a per-CPU magazine, and the number of objects
+   moved between a magazine and the slabs at once. */
+#define MAG_SIZE 16
+#define MAG_BATCH (MAG_SIZE / 2)
+
+/* A per-CPU stack of free objects. */
+struct magazine {
+	size_t cnt;                     /* Number of objects. */
+	void *objs[MAG_SIZE];           /* Objects, hottest last. */
+};
+
+/* An object cache. */
+struct kmem_cache {
+	char name[16];                  /* Name, for statistics. */
+	size_t obj_size;                /* Object size, including padding. */
+	size_t objs_per_slab;           /* Number of objects in a slab. */
+	size_t first_ofs;               /* Offset of uncolored first object. */
+	size_t color_step;              /* Bytes between colors. */
+	size_t color_cnt;               /* Number of colors. */
+	size_t next_color;              /* Color of the next new slab. */
+	kmem_ctor *ctor;                /* Constructor, or null. */
+
+	struct lock lock;               /* Protects the members below. */
+	struct list partial_slabs;      /* Slabs with some free objects. */
+	struct list full_slabs;         /* Slabs with no free objects. */
+	struct slab *empty_slab;        /* A spare, entirely free slab. */
+	size_t slab_cnt;                /* Number of slabs, incl. spare. */
+	size_t free_cnt;                /* Free objects in all slabs. */
+
+	struct magazine mags[CPU_CNT];  /* Per-CPU magazines. */
+	struct list_elem elem;          /* Element in all_caches. */
+};
+
+/* A slab.  Stored at the start of its own page. */
+struct slab {
+	unsigned magic;                 /* Always set to SLAB_MAGIC. */
+	struct kmem_cache *cache;       /* Owning cache. */
+	struct list_elem elem;          /* Element in a slab list. */
+	uint8_t *objs;                  /* First object. */
+	size_t free_cnt;                /* Number of free objects. */
+	uint16_t free[];                /* Indices of free objects. */
+};
+
+/* All caches, for statistics. */
+static struct list all_caches;
+
+/* Initializes the slab allocator. */
+void
+kmem_cache_init (void) {
+	list_init (&all_caches);
+}
+
+/* Creates and returns a cache of SIZE-byte objects aligned on
+   ALIGN bytes, which must be 0 (for pointer alignment) or a
+   power of 2.  If CTOR is nonnull, it is run on each object when
+   the object's slab is created.  NAME identifies the cache in
+   statistics.
+
+   Caches live forever.  They are meant to be created once, while
+   initializing the subsystem whose objects they hold, so running
+   out of memory here is fatal. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, size_t align,
+		kmem_ctor *ctor) {
+	struct kmem_cache *c;
+	enum intr_level old_level;
+	size_t n, ofs = 0;
+
+	if (align < sizeof (void *))
+		align = sizeof (void *);
+	ASSERT ((align & (align - 1)) == 0);
+	ASSERT (size > 0 && ROUND_UP (size, align) <= PGSIZE / 4);
+
+	c = calloc (1, sizeof *c);
+	if (c == NULL)
+		PANIC ("kmem_cache_create: out of memory");
+	strlcpy (c->name, name, sizeof c->name);
+	c->obj_size = ROUND_UP (size, align);
+	c->ctor = ctor;
+	lock_init (&c->lock);
+	list_init (&c->partial_slabs);
+	list_init (&c->full_slabs);
+
+	/* Fit as many objects as possible after the header. */
+	for (n = PGSIZE / c->obj_size; n > 0; n--) {
+		ofs = ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t), align);
+		if (ofs + n * c->obj_size <= PGSIZE)
+			break;
+	}
+	ASSERT (n > 0);
+	c->objs_per_slab = n;
+	c->first_ofs = ofs;
+	c->color_step = align > CACHE_LINE ? align : CACHE_LINE;
+	c->color_cnt = (PGSIZE - ofs - n * c->obj_size) / c->color_step + 1;
+
+	old_level = intr_disable ();
+	list_push_back (&all_caches, &c->elem);
+	intr_set_level (old_level);
+	return c;
+}
+
+/* Returns the slab that holds OBJ, which must belong to C. */
+static struct slab *
+obj_to_slab (struct kmem_cache *c, void *obj) {
+	struct slab *s = pg_round_down (obj);
+
+	ASSERT (s->magic == SLAB_MAGIC);
+	ASSERT (s->cache == c);
+	ASSERT (((uint8_t *) obj - s->objs) % c->obj_size == 0);
+	return s;
+}
+
+/* Creates a new slab for C and constructs its objects.  Returns
+   a null pointer if no page is available. */
+static struct slab *
+slab_create (struct kmem_cache *c) {
+	struct slab *s = palloc_get_page (0);
+	size_t i;
+
+	if (s == NULL)
+		return NULL;
+
+	s->magic = SLAB_MAGIC;
+	s->cache = c;
+	s->objs = (uint8_t *) s + c->first_ofs + c->next_color * c->color_step;
+	c->next_color = (c->next_color + 1) % c->color_cnt;
+
+	/* Stack the indices so that objects go out in address order. */
+	s->free_cnt = c->objs_per_slab;
+	for (i = 0; i < c->objs_per_slab; i++)
+		s->free[i] = c->objs_per_slab - 1 - i;
+
+	if (c->ctor != NULL)
+		for (i = 0; i < c->objs_per_slab; i++)
+			c->ctor (s->objs + i * c->obj_size);
+
+	c->slab_cnt++;
+	c->free_cnt += c->objs_per_slab;
+	return s;
+}
+
+/* Takes up to CNT objects out of C's slabs, growing C as
+   needed, and stores them in OBJS.  Returns the number of
+   objects taken, which is less than CNT only if memory ran
+   out.  C's lock must be held. */
+static size_t
+cache_grab (struct kmem_cache *c, void **objs, size_t cnt) {
+	size_t i;
+
+	for (i = 0; i < cnt; i++) {
+		struct slab *s;
+
+		if (!list_empty (&c->partial_slabs))
+			s = list_entry (list_front (&c->partial_slabs), struct slab, elem);
+		else {
+			s = c->empty_slab;
+			c->empty_slab = NULL;
+			if (s == NULL)
+				s = slab_create (c);
+			if (s == NULL)
+				break;
+			list_push_front (&c->partial_slabs, &s->elem);
+		}
+
+		objs[i] = s->objs + s->free[--s->free_cnt] * c->obj_size;
+		c->free_cnt--;
+		if (s->free_cnt == 0) {
+			list_remove (&s->elem);
+			list_push_front (&c->full_slabs, &s->elem);
+		}
+	}
+	return i;
+}
+
+/* Returns the CNT objects in OBJS to C's slabs.  Keeps at most
+   one entirely free slab and gives any others back to the page
+   allocator.  C's lock must be held. */
+static void
+cache_release (struct kmem_cache *c, void **objs, size_t cnt) {
+	size_t i;
+
+	for (i = 0; i < cnt; i++) {
+		struct slab *s = obj_to_slab (c, objs[i]);
+
+		if (s->free_cnt == 0) {
+			list_remove (&s->elem);
+			list_push_front (&c->partial_slabs, &s->elem);
+		}
+		s->free[s->free_cnt++] = ((uint8_t *) objs[i] - s->objs) / c->obj_size;
+		c->free_cnt++;
+
+		if (s->free_cnt == c->objs_per_slab) {
+			list_remove (&s->elem);
+			if (c->empty_slab == NULL)
+				c->empty_slab = s;
+			else {
+				c->slab_cnt--;
+				c->free_cnt -= c->objs_per_slab;
+				palloc_free_page (s);
+			}
+		}
+	}
+}
+
+/* Allocates and returns an object from C.  The object is in the
+   state C's constructor leaves it in, or, without a constructor,
+   has unspecified contents.  Returns a null pointer if memory is
+   not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c) {
+	void *batch[MAG_BATCH];
+	struct magazine *m;
+	enum intr_level old_level;
+	size_t cnt, i;
+	void *obj;
+
+	old_level = intr_disable ();
+	m = &c->mags[cpu_id ()];
+	if (m->cnt > 0) {
+		obj = m->objs[--m->cnt];
+		intr_set_level (old_level);
+		return obj;
+	}
+	intr_set_level (old_level);
+
+	lock_acquire (&c->lock);
+	cnt = cache_grab (c, batch, MAG_BATCH);
+	lock_release (&c->lock);
+	if (cnt == 0)
+		return NULL;
+
+	/* Keep one object and load the rest into the magazine.
+	   Another thread may have refilled it while we held the
+	   lock, in which case the excess goes straight back. */
+	obj = batch[--cnt];
+	old_level = intr_disable ();
+	m = &c->mags[cpu_id ()];
+	for (i = 0; i < cnt && m->cnt < MAG_SIZE; i++)
+		m->objs[m->cnt++] = batch[i];
+	intr_set_level (old_level);
+
+	if (i < cnt) {
+		lock_acquire (&c->lock);
+		cache_release (c, batch + i, cnt - i);
+		lock_release (&c->lock);
+	}
+	return obj;
+}
+
+/* Frees OBJ, which must have been allocated from C.  Does
+   nothing if OBJ is a null pointer. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj) {
+	void *batch[MAG_BATCH];
+	struct magazine *m;
+	enum intr_level old_level;
+
+	if (obj == NULL)
+		return;
+	obj_to_slab (c, obj);
+
+#ifndef NDEBUG
+	/* Clear the object to help detect use-after-free bugs, unless
+	   it has to stay constructed. */
+	if (c->ctor == NULL)
+		memset (obj, 0xcc, c->obj_size);
+#endif
+
+	old_level = intr_disable ();
+	m = &c->mags[cpu_id ()];
+	if (m->cnt < MAG_SIZE) {
+		m->objs[m->cnt++] = obj;
+		intr_set_level (old_level);
+		return;
+	}
+
+	/* The magazine is full.  Flush its coldest objects. */
+	memcpy (batch, m->objs, sizeof batch);
+	memmove (m->objs, m->objs + MAG_BATCH,
+			sizeof *m->objs * (MAG_SIZE - MAG_BATCH));
+	m->cnt -= MAG_BATCH;
+	m->objs[m->cnt++] = obj;
+	intr_set_level (old_level);
+
+	lock_acquire (&c->lock);
+	cache_release (c, batch, MAG_BATCH);
+	lock_release (&c->lock);
+}
+
+/* Prints the memory used by each cache and the fraction of it
+   not taken up by allocated objects. */
+void
+kmem_cache_print_stats (void) {
+	struct list_elem *e;
+
+	for (e = list_begin (&all_caches); e != list_end (&all_caches);
+			e = list_next (e)) {
+		struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+		size_t total = c->slab_cnt * c->objs_per_slab;
+		size_t used = total - c->free_cnt;
+		size_t bytes = c->slab_cnt * PGSIZE;
+		unsigned cpu;
+
+		for (cpu = 0; cpu < CPU_CNT; cpu++)
+			used -= c->mags[cpu].cnt;
+		printf ("Slab: %s: %zu of %zu %zu-byte objects in use, "
+				"%zu slabs (%zu kB), %zu%% unused\n",
+				c->name, used, total, c->obj_size, c->slab_cnt, bytes / 1024,
+				bytes ? (bytes - used * c->obj_size) * 100 / bytes : 0);
+	}
+}
@@ -31,6 +31,7 @@
 #include <string.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -188,7 +189,12 @@ lock_acquire (struct lock *lock) {
 	ASSERT (!intr_context ());
 	ASSERT (!lock_held_by_current_thread (lock));
 
+	struct thread *holder = lock->holder;
+	if (holder != NULL)
+		TRACE (TRACE_LOCK_CONTEND, lock, holder->tid);
 	sema_down (&lock->semaphore);
+	if (holder != NULL)
+		TRACE (TRACE_LOCK_ACQUIRED, lock, 0);
 	lock->holder = thread_current ();
 }
 
@@ -9,6 +9,7 @@
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
 #include "intrinsic.h"
 #ifdef USERPROG
@@ -308,6 +309,17 @@ thread_yield (void) {
 	intr_set_level (old_level);
 }
 
+/* Returns true if a thread other than the running one is ready
+   to run. */
+bool
+thread_others_ready (void) {
+	enum intr_level old_level = intr_disable ();
+	bool ready = !list_empty (&ready_list);
+
+	intr_set_level (old_level);
+	return ready;
+}
+
 /* Sets the current thread's priority to NEW_PRIORITY. */
 void
 thread_set_priority (int new_priority) {
@@ -368,6 +380,9 @@ idle (void *idle_started_ UNUSED) {
 		intr_disable ();
 		thread_block ();
 
+		/* Put the idle time to use zeroing pages. */
+		palloc_idle ();
+
 		/* Re-enable interrupts and wait for the next one.
 
 		   The `sti' instruction disables interrupts until the
@@ -570,6 +585,8 @@ schedule (void) {
 			list_push_back (&destruction_req, &curr->elem);
 		}
 
+		TRACE (TRACE_SCHED_SWITCH, curr->tid, next->tid);
+
 		/* Before switching the thread, we first save the information
 		 * of current running. */
 		thread_launch (next);
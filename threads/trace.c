@@ -0,0 +1,160 @@
+#include "threads/trace.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/cpu.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+/* Events per CPU buffer.  Must be a power of 2.  Once a buffer
+   wraps, the oldest events are overwritten. */
+#define TRACE_BUF_EVENTS 4096
+
+/* A per-CPU ring of trace events.
+   HEAD counts every event ever reserved on this CPU; the slot
+   for event N is N % TRACE_BUF_EVENTS. */
+struct trace_buffer {
+	uint64_t head;
+	struct trace_event events[TRACE_BUF_EVENTS];
+};
+
+static struct trace_buffer trace_buffers[CPU_CNT];
+
+/* Bit mask of enabled event types; zero when tracing is off. */
+uint32_t trace_mask;
+
+/* Mask requested on the command line, armed by trace_init(). */
+static uint32_t requested_mask;
+
+/* TSC and timer tick at trace_init(), for converting TSC
+   deltas to wall time in the dump. */
+static uint64_t start_tsc;
+static int64_t start_ticks;
+
+/* Command-line names of each event type. */
+static const char *type_names[TRACE_TYPE_CNT] = {
+	[TRACE_SCHED_SWITCH] = "sched",
+	[TRACE_PAGE_FAULT] = "fault",
+	[TRACE_SYSCALL_ENTER] = "syscall",
+	[TRACE_SYSCALL_EXIT] = "syscall",
+	[TRACE_DISK_REQUEST] = "disk",
+	[TRACE_DISK_DONE] = "disk",
+	[TRACE_LOCK_CONTEND] = "lock",
+	[TRACE_LOCK_ACQUIRED] = "lock",
+};
+
+/* Parses the value of the "-trace" option: either null, which
+   enables every event, or a comma-separated list of event
+   names from type_names[].  Returns false if VALUE names an
+   unknown event. */
+bool
+trace_parse_option (const char *value) {
+	char buf[64];
+	char *name, *save_ptr;
+
+	if (value == NULL) {
+		requested_mask = (1u << TRACE_TYPE_CNT) - 1;
+		return true;
+	}
+
+	strlcpy (buf, value, sizeof buf);
+	for (name = strtok_r (buf, ",", &save_ptr); name != NULL;
+			name = strtok_r (NULL, ",", &save_ptr)) {
+		uint32_t mask = 0;
+		int i;
+
+		for (i = 0; i < TRACE_TYPE_CNT; i++)
+			if (!strcmp (name, type_names[i]))
+				mask |= 1u << i;
+		if (mask == 0)
+			return false;
+		requested_mask |= mask;
+	}
+	return true;
+}
+
+/* Starts recording the events requested on the command line.
+   Must be called after the timer is calibrated. */
+void
+trace_init (void) {
+	start_tsc = rdtsc ();
+	start_ticks = timer_ticks ();
+	trace_mask = requested_mask;
+}
+
+/* Appends an event of TYPE to the running CPU's buffer.
+   Use the TRACE macro rather than calling this directly.
+
+   Slots are reserved with an atomic increment of the buffer
+   head, so an interrupt handler that fires in the middle of
+   recording simply takes the next slot. */
+void
+trace_record (enum trace_type type, uint64_t arg0, uint64_t arg1) {
+	unsigned cpu = cpu_id ();
+	struct trace_buffer *buf = &trace_buffers[cpu];
+	uint64_t slot = __atomic_fetch_add (&buf->head, 1, __ATOMIC_RELAXED);
+	struct trace_event *e = &buf->events[slot % TRACE_BUF_EVENTS];
+
+	/* thread_current() asserts that the thread is running, which
+	   is not the case inside the scheduler, so locate the thread
+	   from the stack pointer directly. */
+	struct thread *t = pg_round_down (rrsp ());
+
+	e->tsc = rdtsc ();
+	e->type = type;
+	e->cpu = cpu;
+	e->tid = t->tid;
+	e->arg0 = arg0;
+	e->arg1 = arg1;
+}
+
+/* Prints event E as one line of hex digits, byte by byte in
+   memory order. */
+static void
+dump_event (const struct trace_event *e) {
+	static const char digits[] = "0123456789abcdef";
+	const uint8_t *p = (const uint8_t *) e;
+	char line[2 * sizeof *e + 1];
+	size_t i;
+
+	for (i = 0; i < sizeof *e; i++) {
+		line[2 * i] = digits[p[i] >> 4];
+		line[2 * i + 1] = digits[p[i] & 0xf];
+	}
+	line[2 * sizeof *e] = '\0';
+	printf ("trace: %s\n", line);
+}
+
+/* Dumps every CPU's buffer, oldest event first, to the
+   console.  Does nothing if tracing was never enabled. */
+void
+trace_dump (void) {
+	uint64_t tsc_hz = 0;
+	int64_t ticks;
+	unsigned cpu;
+
+	if (trace_mask == 0)
+		return;
+	trace_mask = 0;
+
+	ticks = timer_ticks () - start_ticks;
+	if (ticks > 0)
+		tsc_hz = (rdtsc () - start_tsc) * TIMER_FREQ / ticks;
+
+	printf ("trace: begin cpus=%d tsc_hz=%llu start_tsc=%llu\n",
+			CPU_CNT, tsc_hz, start_tsc);
+	for (cpu = 0; cpu < CPU_CNT; cpu++) {
+		struct trace_buffer *buf = &trace_buffers[cpu];
+		uint64_t first = buf->head > TRACE_BUF_EVENTS
+			? buf->head - TRACE_BUF_EVENTS : 0;
+		uint64_t i;
+
+		if (first != 0)
+			printf ("trace: cpu %u dropped %llu events\n", cpu, first);
+		for (i = first; i < buf->head; i++)
+			dump_event (&buf->events[i % TRACE_BUF_EVENTS]);
+	}
+	printf ("trace: end\n");
+}
@@ -0,0 +1,147 @@
+#include "threads/vmalloc.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <string.h>
+#include "threads/init.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+/* Virtually contiguous kernel allocations.
+
+   palloc_get_multiple() can only satisfy a multi-page request
+   from a physically contiguous run of free pages, which a
+   fragmented kernel pool may not have even with plenty of memory
+   free.  vmalloc() instead takes single pages wherever they are
+   and maps them at consecutive addresses in the vmalloc range.
+
+   The range has its own PML4 slot.  vmalloc_init() gives that
+   slot a page directory pointer table in base_pml4 before any
+   other page map level 4 is created.  pml4_create() copies the
+   slot along with the rest of the kernel mappings, so every
+   address space shares the same lower-level tables and sees each
+   new mapping as soon as it is made.  Those tables are never
+   freed.
+
+   Address space is handed out next-fit from a bitmap with one
+   bit per page, so a freed range is not reused right away.
+   Each allocation is followed by one unmapped guard page, so
+   that running off its end faults instead of silently
+   corrupting the next allocation. */
+
+/* Pages of the vmalloc range in use, including guard pages. */
+static struct bitmap *vmalloc_map;
+
+/* Protects vmalloc_map and the page tables of the range. */
+static struct lock vmalloc_lock;
+
+/* Sets up the vmalloc range in base_pml4.  Must be called after
+   base_pml4 is created and before any other page map level 4
+   is. */
+void
+vmalloc_init (void) {
+	size_t page_cnt = VMALLOC_SIZE / PGSIZE;
+	size_t buf_size = bitmap_buf_size (page_cnt);
+	void *pdpt, *buf;
+
+	ASSERT (PML4 (VMALLOC_START) == PML4 (VMALLOC_END - 1));
+	ASSERT (base_pml4[PML4 (VMALLOC_START)] == 0);
+
+	pdpt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+	base_pml4[PML4 (VMALLOC_START)] = vtop (pdpt) | PTE_W | PTE_P;
+
+	buf = palloc_get_multiple (PAL_ASSERT, DIV_ROUND_UP (buf_size, PGSIZE));
+	vmalloc_map = bitmap_create_in_buf (page_cnt, buf, buf_size);
+	lock_init (&vmalloc_lock);
+}
+
+/* Unmaps the PAGE_CNT pages starting at PAGES and frees the
+   physical pages behind them, with one TLB flush for the lot.
+   vmalloc_lock must be held. */
+static void
+unmap_pages (void *pages, size_t page_cnt) {
+	struct mmu_gather tlb;
+	size_t i;
+
+	mmu_gather_init (&tlb, base_pml4);
+	for (i = 0; i < page_cnt; i++) {
+		uint64_t va = (uint64_t) pages + i * PGSIZE;
+		uint64_t *pte = pml4e_walk (base_pml4, va, 0);
+
+		ASSERT (pte != NULL && (*pte & PTE_P));
+		mmu_gather_free_page (&tlb, ptov (PTE_ADDR (*pte)));
+		*pte = 0;
+		mmu_gather_add (&tlb, (void *) va);
+	}
+	mmu_gather_finish (&tlb);
+}
+
+/* Obtains PAGE_CNT pages, not necessarily physically contiguous,
+   from the kernel pool and maps them at consecutive addresses in
+   the vmalloc range.  Returns the first address.  If PAL_ZERO is
+   set in FLAGS, the pages are zeroed.  If memory or address
+   space runs out, returns a null pointer, unless PAL_ASSERT is
+   set in FLAGS, in which case the kernel panics.  PAL_USER may
+   not be set. */
+void *
+vmalloc (enum palloc_flags flags, size_t page_cnt) {
+	size_t page_idx, i;
+	void *pages = NULL;
+
+	ASSERT (vmalloc_map != NULL);
+	ASSERT (!(flags & PAL_USER));
+	if (page_cnt == 0)
+		return NULL;
+
+	lock_acquire (&vmalloc_lock);
+	page_idx = bitmap_scan_and_flip_next (vmalloc_map, page_cnt + 1, false);
+	if (page_idx != BITMAP_ERROR) {
+		pages = (void *) (VMALLOC_START + page_idx * PGSIZE);
+		for (i = 0; i < page_cnt; i++) {
+			uint64_t va = (uint64_t) pages + i * PGSIZE;
+			void *page = palloc_get_page (flags & PAL_ZERO);
+			uint64_t *pte = page ? pml4e_walk (base_pml4, va, 1) : NULL;
+
+			if (pte == NULL) {
+				if (page != NULL)
+					palloc_free_page (page);
+				unmap_pages (pages, i);
+				bitmap_set_multiple (vmalloc_map, page_idx, page_cnt + 1, false);
+				pages = NULL;
+				break;
+			}
+			*pte = vtop (page) | PTE_G | PTE_W | PTE_P;
+		}
+	}
+	lock_release (&vmalloc_lock);
+
+	if (pages == NULL && (flags & PAL_ASSERT))
+		PANIC ("vmalloc: out of memory");
+	return pages;
+}
+
+/* Frees the PAGE_CNT pages at PAGES, which must have been
+   obtained from vmalloc() with the same PAGE_CNT. */
+void
+vfree (void *pages, size_t page_cnt) {
+	size_t page_idx;
+
+	if (pages == NULL || page_cnt == 0)
+		return;
+	ASSERT (pg_ofs (pages) == 0);
+	ASSERT (is_vmalloc_vaddr (pages));
+
+	page_idx = ((uint64_t) pages - VMALLOC_START) / PGSIZE;
+	ASSERT (bitmap_all (vmalloc_map, page_idx, page_cnt + 1));
+
+#ifndef NDEBUG
+	memset (pages, 0xcc, PGSIZE * page_cnt);
+#endif
+
+	lock_acquire (&vmalloc_lock);
+	unmap_pages (pages, page_cnt);
+	bitmap_set_multiple (vmalloc_map, page_idx, page_cnt + 1, false);
+	lock_release (&vmalloc_lock);
+}
@@ -1,7 +1,17 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
 #include "vm/vm.h"
+#include <bitmap.h>
+#include <stdio.h>
 #include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/zswap.h"
+
+/* Number of sectors in a swap slot, which holds one page. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -9,6 +19,26 @@ static bool anon_swap_in (struct page *page, void *kva);
 static bool anon_swap_out (struct page *page);
 static void anon_destroy (struct page *page);
 
+/* Swap slots in use, and the lock that guards them.  Slots are
+ * handed out next-fit, so that pages swapped out together land in
+ * adjacent slots, and can later be read back together. */
+static struct bitmap *swap_slots;
+static struct lock swap_lock;
+
+/* The page each swap slot in use belongs to, also guarded by
+ * SWAP_LOCK.  A page is freed only after anon_destroy() takes it
+ * out, so the pages found here are alive while SWAP_LOCK is
+ * held. */
+static struct page **slot_pages;
+
+size_t anon_ra_window = 8;
+
+/* Statistics. */
+static uint64_t slot_write_cnt;   /* Slots written. */
+static uint64_t run_write_cnt;    /* Disk commands that wrote them. */
+static uint64_t ra_cnt;           /* Pages read ahead. */
+static uint64_t ra_hit_cnt;       /* ...and faulted on later. */
+
 /* DO NOT MODIFY this struct */
 static const struct page_operations anon_ops = {
 	.swap_in = anon_swap_in,
@@ -20,8 +50,17 @@ static const struct page_operations anon_ops = {
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	/* Without a swap disk, only pages that can be recreated from
+	 * their region are ever evicted. */
+	swap_disk = disk_get (1, 1);
+	swap_slots = bitmap_create (swap_disk != NULL
+			? disk_size (swap_disk) / SECTORS_PER_SLOT : 0);
+	if (swap_slots != NULL)
+		slot_pages = calloc (bitmap_size (swap_slots) + 1, sizeof *slot_pages);
+	if (slot_pages == NULL)
+		PANIC ("no memory for the swap slot map");
+	lock_init (&swap_lock);
+	zswap_init ();
 }
 
 /* Initialize the file mapping */
@@ -31,22 +70,291 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->slot = BITMAP_ERROR;
+	anon_page->readahead = false;
+	anon_page->unbacked = false;
+	anon_page->zchunk = BITMAP_ERROR;
+	return true;
+}
+
+/* Frees ANON_PAGE's swap slot, if it has one. */
+static void
+release_slot (struct anon_page *anon_page) {
+	if (anon_page->slot != BITMAP_ERROR) {
+		lock_acquire (&swap_lock);
+		bitmap_reset (swap_slots, anon_page->slot);
+		slot_pages[anon_page->slot] = NULL;
+		lock_release (&swap_lock);
+		anon_page->slot = BITMAP_ERROR;
+	}
 }
 
-/* Swap in the page by read contents from the swap disk. */
+/* Reads the slots around that of PAGE, which the running process
+ * is claiming into KVA: PAGE's own, and those of the other pages
+ * of the running process in the same window of anon_ra_window
+ * slots that are not resident.  Pages swapped out together sit in
+ * adjacent slots, and are likely to be needed together again.
+ *
+ * The pages read ahead go into the swap cache: they become
+ * resident, but stay unmapped until their own first fault, which
+ * only has to map them.  Until then they are evicted for free, as
+ * their slots still hold them. */
+static void
+swap_readahead (struct page *page, void *kva) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	size_t window = anon_ra_window < ANON_RA_MAX ? anon_ra_window : ANON_RA_MAX;
+	size_t first = page->anon.slot - page->anon.slot % window;
+	size_t cnt = bitmap_size (swap_slots) - first;
+	struct page *pages[ANON_RA_MAX];
+	void *kvas[ANON_RA_MAX];
+	size_t i, j;
+
+	if (cnt > window)
+		cnt = window;
+
+	/* Find the pages to read.  Only the running process changes
+	 * the residence of its pages that are not resident, so those
+	 * stay as they are until read. */
+	lock_acquire (&swap_lock);
+	for (i = 0; i < cnt; i++) {
+		struct page *p = slot_pages[first + i];
+
+		if (p != NULL && p != page && (p->frame != NULL
+					|| spt_find_page (spt, p->va) != p))
+			p = NULL;
+		pages[i] = p;
+	}
+	lock_release (&swap_lock);
+
+	/* Readahead must not evict anything, so it stops when free
+	 * memory runs out. */
+	for (i = 0; i < cnt; i++) {
+		if (pages[i] == page)
+			kvas[i] = kva;
+		else if (pages[i] != NULL) {
+			kvas[i] = palloc_get_page (PAL_USER);
+			if (kvas[i] == NULL)
+				pages[i] = NULL;
+		}
+	}
+
+	/* One disk command for each run of adjacent slots. */
+	for (i = 0; i < cnt; i = j) {
+		if (pages[i] == NULL) {
+			j = i + 1;
+			continue;
+		}
+		for (j = i; j < cnt && pages[j] != NULL; j++)
+			continue;
+		disk_read_multiple (swap_disk, (first + i) * SECTORS_PER_SLOT,
+				&kvas[i], j - i, SECTORS_PER_SLOT);
+	}
+
+	for (i = 0; i < cnt; i++) {
+		if (pages[i] == NULL || pages[i] == page)
+			continue;
+		pages[i]->anon.readahead = true;
+		if (vm_cache_page (pages[i], kvas[i]))
+			ra_cnt++;
+		else {
+			pages[i]->anon.readahead = false;
+			palloc_free_page (kvas[i]);
+		}
+	}
+}
+
+/* Returns true if PAGE, which is resident but not mapped, was
+ * read ahead and this is its first fault. */
+bool
+anon_readahead_hit (struct page *page) {
+	if (page->operations->type != VM_ANON || !page->anon.readahead)
+		return false;
+	page->anon.readahead = false;
+	ra_hit_cnt++;
+	return true;
+}
+
+/* Swap in the page by read contents from zswap or the swap disk.
+ * A page read from the disk keeps its slot, so that it need not be
+ * written again if it is evicted before it is modified.  A page
+ * without either was evicted unmodified, and is recreated from its
+ * region. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+
+	/* Does the running process claim PAGE for itself, rather than
+	 * fork() copying it? */
+	bool claiming = page->frame != NULL && page->frame->kva == kva;
+
+	anon_page->readahead = false;
+	if (zswap_load (page, kva, !claiming)) {
+		if (claiming)
+			anon_page->unbacked = true;
+		return true;
+	}
+	if (anon_page->slot == BITMAP_ERROR)
+		return page->vma->file == NULL
+			|| vma_read (page->vma, page->va, kva);
+
+	if (claiming && anon_ra_window > 1)
+		swap_readahead (page, kva);
+	else
+		disk_read_multiple (swap_disk, anon_page->slot * SECTORS_PER_SLOT,
+				&kva, 1, SECTORS_PER_SLOT);
+	return true;
 }
 
-/* Swap out the page by writing contents to the swap disk. */
+/* Swap out the page by writing contents to the swap disk.
+ * The page must be unmapped already.  Returns false if there is
+ * no free swap slot. */
 static bool
 anon_swap_out (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	bool ok;
+
+	anon_swap_out_multiple (&page, 1, &ok);
+	return ok;
+}
+
+/* Returns true if PAGE, which is unmapped, must be written to swap
+ * to be evicted: that is, unless it is unmodified since swap_in(),
+ * or since its region initialized it, and either can do it
+ * again.  zswap keeps no copy of the pages it gives back. */
+static bool
+needs_write (struct page *page) {
+	if (page->anon.unbacked || pml4_is_dirty (page->pml4, page->va))
+		return true;
+	return page->anon.slot == BITMAP_ERROR && page->vma->init != NULL;
+}
+
+/* Sorts the CNT indexes in IDX[] by the swap slot of the page of
+ * PAGES[] they refer to. */
+static void
+sort_by_slot (struct page **pages, size_t *idx, size_t cnt) {
+	size_t i, j;
+
+	for (i = 1; i < cnt; i++) {
+		size_t x = idx[i];
+		for (j = i; j > 0 && pages[idx[j - 1]]->anon.slot > pages[x]->anon.slot;
+				j--)
+			idx[j] = idx[j - 1];
+		idx[j] = x;
+	}
+}
+
+/* Swaps out the CNT anonymous pages in PAGES[], at most
+ * ANON_SWAP_BATCH, which must be unmapped already, and sets OK[i]
+ * to whether PAGES[i] could be.
+ *
+ * The pages that need a new slot get adjacent ones when that many
+ * are free.  The writes then go out in ascending sector order,
+ * with a single disk command for each run of adjacent slots. */
+void
+anon_swap_out_multiple (struct page **pages, size_t cnt, bool *ok) {
+	size_t writes[ANON_SWAP_BATCH];   /* Indexes into PAGES[]. */
+	const void *kvas[ANON_SWAP_BATCH];
+	size_t write_cnt = 0, new_cnt = 0, cluster;
+	size_t i, j;
+
+	ASSERT (cnt <= ANON_SWAP_BATCH);
+
+	for (i = 0; i < cnt; i++) {
+		struct anon_page *anon_page = &pages[i]->anon;
+
+		ok[i] = true;
+		if (!needs_write (pages[i]))
+			continue;
+		if (zswap_store (pages[i], pages[i]->frame->kva)) {
+			/* Whatever the slot holds is out of date. */
+			release_slot (anon_page);
+			anon_page->unbacked = false;
+			continue;
+		}
+		writes[write_cnt++] = i;
+		if (anon_page->slot == BITMAP_ERROR)
+			new_cnt++;
+	}
+
+	lock_acquire (&swap_lock);
+	cluster = new_cnt > 0
+		? bitmap_scan_and_flip_next (swap_slots, new_cnt, false)
+		: BITMAP_ERROR;
+	for (i = j = 0; i < write_cnt; i++) {
+		struct anon_page *anon_page = &pages[writes[i]]->anon;
+
+		if (anon_page->slot == BITMAP_ERROR) {
+			anon_page->slot = cluster != BITMAP_ERROR ? cluster++
+				: bitmap_scan_and_flip_next (swap_slots, 1, false);
+			if (anon_page->slot != BITMAP_ERROR)
+				slot_pages[anon_page->slot] = pages[writes[i]];
+		}
+
+		/* A page left without a slot stays in memory. */
+		if (anon_page->slot != BITMAP_ERROR)
+			writes[j++] = writes[i];
+		else
+			ok[writes[i]] = false;
+	}
+	lock_release (&swap_lock);
+	write_cnt = j;
+
+	sort_by_slot (pages, writes, write_cnt);
+	for (i = 0; i < write_cnt; i = j) {
+		size_t first = pages[writes[i]]->anon.slot;
+
+		for (j = i; j < write_cnt
+				&& pages[writes[j]]->anon.slot == first + (j - i); j++)
+			kvas[j - i] = pages[writes[j]]->frame->kva;
+		disk_write_multiple (swap_disk, first * SECTORS_PER_SLOT, kvas, j - i,
+				SECTORS_PER_SLOT);
+		run_write_cnt++;
+	}
+	for (i = 0; i < write_cnt; i++)
+		pages[writes[i]]->anon.unbacked = false;
+	slot_write_cnt += write_cnt;
+}
+
+/* Writes KVA, the contents of PAGE, which is not resident and has
+ * no swap slot, to a new slot on the swap disk.  This is how zswap
+ * makes room.  Returns false if the swap disk is full. */
+bool
+anon_writeback (struct page *page, const void *kva) {
+	size_t slot;
+
+	lock_acquire (&swap_lock);
+	slot = bitmap_scan_and_flip_next (swap_slots, 1, false);
+	lock_release (&swap_lock);
+	if (slot == BITMAP_ERROR)
+		return false;
+
+	page->anon.slot = slot;
+	disk_write_multiple (swap_disk, slot * SECTORS_PER_SLOT, &kva, 1,
+			SECTORS_PER_SLOT);
+	slot_write_cnt++;
+	run_write_cnt++;
+
+	/* Only now may swap_readahead() find the page. */
+	lock_acquire (&swap_lock);
+	slot_pages[slot] = page;
+	lock_release (&swap_lock);
+	return true;
+}
+
+/* Prints swap statistics. */
+void
+anon_print_stats (void) {
+	printf ("Swap: %zu of %zu slots in use, %llu written in %llu runs\n",
+			bitmap_count (swap_slots, 0, bitmap_size (swap_slots), true),
+			bitmap_size (swap_slots), slot_write_cnt, run_write_cnt);
+	if (ra_cnt > 0)
+		printf ("Swap: %llu pages read ahead, %llu%% of them used\n",
+				ra_cnt, ra_hit_cnt * 100 / ra_cnt);
+	zswap_print_stats ();
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	zswap_invalidate (page);
+	release_slot (&page->anon);
 }
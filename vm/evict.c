@@ -0,0 +1,462 @@
+/* evict.c: Page replacement policies.
+ *
+ * A policy sees a frame when its page is mapped, and keeps it until
+ * the frame is evicted or freed.  It cannot see memory accesses
+ * themselves, only the accessed bits that the CPU sets in the page
+ * tables, so each policy samples and clears those bits on the
+ * frames it considers for eviction.  The access that faulted a
+ * page in sets its accessed bit, too.
+ *
+ * The policy is chosen at boot with -evict=NAME:
+ *
+ * - clock: second chance over all frames, preferring clean pages.
+ *
+ * - fifo: evicts the page that was mapped longest ago.  Only useful
+ *   as a baseline.
+ *
+ * - 2q: the full 2Q algorithm of Johnson and Shasha.  Pages start
+ *   in a FIFO (A1in) that takes a quarter of memory.  Pages evicted
+ *   from it are remembered (A1out), and only a page faulted back in
+ *   while remembered goes to the main queue (Am), which is run as a
+ *   clock.  A scan thus only ever displaces A1in.
+ *
+ * - arc: Adaptive Replacement Cache, in the CAR form of Bansal and
+ *   Modha, which runs ARC's two lists as clocks.  T1 holds pages
+ *   seen once and T2 pages seen again; B1 and B2 remember pages
+ *   evicted from each, and a fault on a remembered page moves the
+ *   target size P of T1 towards the list that would have kept it.
+ *
+ * Remembered pages are `struct page's that are not resident; they
+ * are linked through their ghost_elem. */
+
+#include "vm/evict.h"
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/mmu.h"
+#include "vm/vm.h"
+
+static const struct evict_policy clock_policy, fifo_policy;
+static const struct evict_policy twoq_policy, arc_policy;
+
+/* The policy in use. */
+const struct evict_policy *evict_policy = &clock_policy;
+
+/* Statistics. */
+static uint64_t ref_cnt;        /* Accessed bits found set. */
+static uint64_t ghost_hit_cnt;  /* Page-ins of remembered pages. */
+
+/* Selects the policy named VALUE.  Returns false if there is no
+ * such policy. */
+bool
+evict_parse_option (const char *value) {
+	static const struct evict_policy *policies[] = {
+		&clock_policy, &fifo_policy, &twoq_policy, &arc_policy,
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof policies / sizeof *policies; i++)
+		if (value != NULL && !strcmp (value, policies[i]->name)) {
+			evict_policy = policies[i];
+			return true;
+		}
+	return false;
+}
+
+/* Returns true if any of FRAME's pages was accessed since the
+ * last call, and clears their accessed bits. */
+static bool
+test_and_clear_accessed (struct frame *frame) {
+	struct list_elem *e;
+	bool accessed = false;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (pml4_is_accessed (page->pml4, page->va)) {
+			pml4_set_accessed (page->pml4, page->va, false);
+			accessed = true;
+		}
+	}
+	if (accessed)
+		ref_cnt++;
+	return accessed;
+}
+
+/* Returns true if any of FRAME's pages was written to. */
+static bool
+is_dirty (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (pml4_is_dirty (page->pml4, page->va))
+			return true;
+	}
+	return false;
+}
+
+/* A list of frames or remembered pages, and its length. */
+struct queue {
+	struct list list;
+	size_t cnt;
+};
+
+static void
+queue_init (struct queue *q) {
+	list_init (&q->list);
+	q->cnt = 0;
+}
+
+/* Frame queues.  FRAME->queue records which queue of the policy
+ * in use the frame is on. */
+
+static void
+frame_push (struct queue *q, struct frame *frame, int id) {
+	list_push_back (&q->list, &frame->elem);
+	q->cnt++;
+	frame->queue = id;
+}
+
+static struct frame *
+frame_pop (struct queue *q) {
+	q->cnt--;
+	return list_entry (list_pop_front (&q->list), struct frame, elem);
+}
+
+static struct frame *
+frame_front (struct queue *q) {
+	return list_entry (list_front (&q->list), struct frame, elem);
+}
+
+static void
+frame_unlink (struct queue *q, struct frame *frame) {
+	list_remove (&frame->elem);
+	q->cnt--;
+}
+
+/* Ghost queues of remembered pages.  PAGE->ghost records which
+ * queue of the policy in use the page is on, or is 0. */
+
+static void
+ghost_push (struct queue *q, struct page *page, int id) {
+	list_push_back (&q->list, &page->ghost_elem);
+	q->cnt++;
+	page->ghost = id;
+}
+
+static void
+ghost_unlink (struct queue *q, struct page *page) {
+	list_remove (&page->ghost_elem);
+	q->cnt--;
+	page->ghost = 0;
+}
+
+/* Forgets the oldest pages of Q until it has at most MAX. */
+static void
+ghost_trim (struct queue *q, size_t max) {
+	while (q->cnt > max) {
+		struct page *page = list_entry (list_front (&q->list), struct page,
+				ghost_elem);
+		ghost_unlink (q, page);
+	}
+}
+
+/* Clock. */
+
+static struct list clock_ring;
+static struct list_elem *clock_hand;  /* Next to look at, or end. */
+static size_t clock_cnt;
+
+static void
+clock_init (void) {
+	list_init (&clock_ring);
+	clock_hand = list_end (&clock_ring);
+}
+
+/* Puts FRAME just behind the hand, so that it gets a full
+ * revolution before it is looked at. */
+static void
+clock_insert (struct frame *frame) {
+	frame->skipped = false;
+	list_insert (clock_hand, &frame->elem);
+	clock_cnt++;
+}
+
+static void
+clock_remove (struct frame *frame) {
+	if (clock_hand == &frame->elem)
+		clock_hand = list_next (clock_hand);
+	list_remove (&frame->elem);
+	clock_cnt--;
+}
+
+/* A page that was accessed since the hand last passed loses its
+ * accessed bit and is kept.  One that was not is taken if clean;
+ * if dirty, it is kept for one more revolution, since writing it
+ * back is costly and a clean page may turn up first.  Every step
+ * of the hand thus clears an accessed bit, marks a dirty page as
+ * skipped, or finds the victim, so a victim costs O(1) steps
+ * amortized. */
+static struct frame *
+clock_victim (void) {
+	size_t i;
+
+	/* Three revolutions clear every accessed bit and skip every
+	 * dirty page once. */
+	for (i = 0; i < 3 * clock_cnt; i++) {
+		struct frame *frame;
+
+		if (clock_hand == list_end (&clock_ring))
+			clock_hand = list_begin (&clock_ring);
+		frame = list_entry (clock_hand, struct frame, elem);
+		clock_hand = list_next (clock_hand);
+
+		if (test_and_clear_accessed (frame))
+			frame->skipped = false;
+		else if (!frame->skipped && is_dirty (frame))
+			frame->skipped = true;
+		else {
+			clock_remove (frame);
+			return frame;
+		}
+	}
+	return NULL;
+}
+
+static void
+no_forget (struct page *page UNUSED) {
+}
+
+static const struct evict_policy clock_policy = {
+	.name = "clock",
+	.init = clock_init,
+	.insert = clock_insert,
+	.remove = clock_remove,
+	.victim = clock_victim,
+	.forget = no_forget,
+};
+
+/* FIFO. */
+
+static struct queue fifo;
+
+static void
+fifo_init (void) {
+	queue_init (&fifo);
+}
+
+static void
+fifo_insert (struct frame *frame) {
+	frame_push (&fifo, frame, 0);
+}
+
+static void
+fifo_remove (struct frame *frame) {
+	frame_unlink (&fifo, frame);
+}
+
+static struct frame *
+fifo_victim (void) {
+	return fifo.cnt > 0 ? frame_pop (&fifo) : NULL;
+}
+
+static const struct evict_policy fifo_policy = {
+	.name = "fifo",
+	.init = fifo_init,
+	.insert = fifo_insert,
+	.remove = fifo_remove,
+	.victim = fifo_victim,
+	.forget = no_forget,
+};
+
+/* 2Q. */
+
+enum { A1IN = 1, AM, A1OUT };
+static struct queue a1in, am, a1out;
+
+static void
+twoq_init (void) {
+	queue_init (&a1in);
+	queue_init (&am);
+	queue_init (&a1out);
+}
+
+static void
+twoq_insert (struct frame *frame) {
+	struct page *page = frame->page;
+
+	if (page->ghost == A1OUT) {
+		ghost_unlink (&a1out, page);
+		ghost_hit_cnt++;
+		frame_push (&am, frame, AM);
+	} else
+		frame_push (&a1in, frame, A1IN);
+}
+
+static void
+twoq_remove (struct frame *frame) {
+	frame_unlink (frame->queue == AM ? &am : &a1in, frame);
+}
+
+static struct frame *
+twoq_victim (void) {
+	size_t resident = a1in.cnt + am.cnt;
+	size_t i;
+
+	/* Evict from A1in while it holds more than its quarter, and
+	 * remember what it evicts for as long as half of memory would
+	 * take to cycle through. */
+	if (a1in.cnt > 0 && (a1in.cnt > resident / 4 || am.cnt == 0)) {
+		struct frame *frame = frame_pop (&a1in);
+
+		ghost_push (&a1out, frame->page, A1OUT);
+		ghost_trim (&a1out, resident / 2 > 0 ? resident / 2 : 1);
+		return frame;
+	}
+
+	/* Otherwise Am, as a clock.  Two rounds clear every accessed
+	 * bit. */
+	for (i = 0; i < 2 * am.cnt; i++) {
+		struct frame *frame = frame_front (&am);
+
+		if (!test_and_clear_accessed (frame))
+			break;
+		list_push_back (&am.list, list_pop_front (&am.list));
+	}
+	return am.cnt > 0 ? frame_pop (&am) : NULL;
+}
+
+static void
+twoq_forget (struct page *page) {
+	if (page->ghost == A1OUT)
+		ghost_unlink (&a1out, page);
+}
+
+static const struct evict_policy twoq_policy = {
+	.name = "2q",
+	.init = twoq_init,
+	.insert = twoq_insert,
+	.remove = twoq_remove,
+	.victim = twoq_victim,
+	.forget = twoq_forget,
+};
+
+/* ARC. */
+
+enum { T1 = 1, T2, B1, B2 };
+static struct queue t1, t2, b1, b2;
+static size_t arc_p;            /* Target size of T1. */
+
+static void
+arc_init (void) {
+	queue_init (&t1);
+	queue_init (&t2);
+	queue_init (&b1);
+	queue_init (&b2);
+	arc_p = 0;
+}
+
+static size_t
+max_size (size_t a, size_t b) {
+	return a > b ? a : b;
+}
+
+/* A fault on a page remembered in B1 means T1 was too small, and
+ * one in B2 that T2 was.  Either way the page was seen before, so
+ * it goes to T2. */
+static void
+arc_insert (struct frame *frame) {
+	struct page *page = frame->page;
+	size_t c = t1.cnt + t2.cnt + 1;
+
+	if (page->ghost == B1) {
+		arc_p += max_size (1, b2.cnt / b1.cnt);
+		if (arc_p > c)
+			arc_p = c;
+		ghost_unlink (&b1, page);
+	} else if (page->ghost == B2) {
+		size_t delta = max_size (1, b1.cnt / b2.cnt);
+		arc_p = arc_p > delta ? arc_p - delta : 0;
+		ghost_unlink (&b2, page);
+	} else {
+		frame->skipped = false;
+		frame_push (&t1, frame, T1);
+		return;
+	}
+	ghost_hit_cnt++;
+	frame_push (&t2, frame, T2);
+}
+
+static void
+arc_remove (struct frame *frame) {
+	frame_unlink (frame->queue == T2 ? &t2 : &t1, frame);
+}
+
+/* Sweeps T1 while it is larger than its target, and T2 otherwise,
+ * until it finds a page whose accessed bit is clear.  A page in T1
+ * whose bit is set moves to T2; but the first time, the bit may
+ * only show the fault that brought the page in, so it merely goes
+ * round T1 once more.  Each step moves a page on or clears a bit,
+ * so a victim costs O(1) steps amortized. */
+static struct frame *
+arc_victim (void) {
+	size_t c = t1.cnt + t2.cnt;
+	struct frame *victim = NULL;
+	size_t i;
+
+	if (c == 0)
+		return NULL;
+
+	for (i = 0; victim == NULL; i++) {
+		bool from_t1 = t1.cnt > 0
+			&& (t1.cnt >= max_size (1, arc_p) || t2.cnt == 0);
+		struct frame *frame = frame_pop (from_t1 ? &t1 : &t2);
+
+		/* After 3C steps, pages keep being accessed as fast as they
+		 * are swept; take this one anyway. */
+		if (i >= 3 * c || !test_and_clear_accessed (frame)) {
+			ghost_push (from_t1 ? &b1 : &b2, frame->page, from_t1 ? B1 : B2);
+			victim = frame;
+		} else if (from_t1 && !frame->skipped) {
+			frame->skipped = true;
+			frame_push (&t1, frame, T1);
+		} else
+			frame_push (&t2, frame, T2);
+	}
+
+	/* Remember at most C pages besides T1's, and 2C in all. */
+	ghost_trim (&b1, c - t1.cnt);
+	ghost_trim (&b2, 2 * c - (t1.cnt + t2.cnt + b1.cnt));
+	return victim;
+}
+
+static void
+arc_forget (struct page *page) {
+	if (page->ghost == B1)
+		ghost_unlink (&b1, page);
+	else if (page->ghost == B2)
+		ghost_unlink (&b2, page);
+}
+
+static const struct evict_policy arc_policy = {
+	.name = "arc",
+	.init = arc_init,
+	.insert = arc_insert,
+	.remove = arc_remove,
+	.victim = arc_victim,
+	.forget = arc_forget,
+};
+
+/* Prints what the policy saw. */
+void
+evict_print_stats (void) {
+	printf ("Evict: %s policy, %llu accessed bits seen, %llu remembered "
+			"pages faulted back\n", evict_policy->name, ref_cnt, ghost_hit_cnt);
+	if (evict_policy == &arc_policy)
+		printf ("Evict: ARC target %zu of %zu resident pages in T1\n",
+				arc_p, t1.cnt + t2.cnt);
+}
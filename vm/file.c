@@ -1,5 +1,8 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
+#include <round.h>
+#include "threads/mmu.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
@@ -25,34 +28,70 @@ file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
 	/* Set up the handler */
 	page->operations = &file_ops;
 
-	struct file_page *file_page = &page->file;
+	struct file_page *file_page UNUSED = &page->file;
+	return true;
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
 	struct file_page *file_page UNUSED = &page->file;
+
+	return vma_read (page->vma, page->va, kva);
 }
 
-/* Swap out the page by writeback contents to the file. */
+/* Swap out the page by writeback contents to the file.  The page
+ * must be unmapped already; only a page the process wrote to is
+ * written. */
 static bool
 file_backed_swap_out (struct page *page) {
 	struct file_page *file_page UNUSED = &page->file;
+
+	if (pml4_is_dirty (page->pml4, page->va))
+		vma_write (page->vma, page->va, page->frame->kva);
+	return true;
 }
 
-/* Destory the file backed page. PAGE will be freed by the caller. */
+/* Destory the file backed page. PAGE will be freed by the caller.
+ * A resident page the process wrote to is written back to its
+ * region's file first. */
 static void
 file_backed_destroy (struct page *page) {
 	struct file_page *file_page UNUSED = &page->file;
+
+	if (page->frame != NULL && pml4_is_dirty (page->pml4, page->va))
+		vma_write (page->vma, page->va, page->frame->kva);
 }
 
-/* Do the mmap */
+/* Do the mmap: maps LENGTH bytes of FILE from OFFSET at ADDR as one
+ * region.  Bytes past the end of FILE read as zero and are not
+ * written back.  Returns ADDR, or a null pointer on failure. */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	off_t file_left;
+	size_t read_bytes;
+
+	if (addr == NULL || pg_ofs (addr) != 0 || length == 0
+			|| offset < 0 || offset % PGSIZE != 0)
+		return NULL;
+
+	file_left = file_length (file) - offset;
+	read_bytes = file_left <= 0 ? 0
+		: (size_t) file_left < length ? (size_t) file_left : length;
+	if (read_bytes == 0)
+		return NULL;
+	if (!vm_map_region (VM_FILE, addr, DIV_ROUND_UP (length, PGSIZE),
+				writable, file, offset, read_bytes))
+		return NULL;
+	return addr;
 }
 
-/* Do the munmap */
+/* Do the munmap: unmaps the mapping that do_mmap() made at ADDR. */
 void
 do_munmap (void *addr) {
+	struct vma *v = vma_find (&thread_current ()->spt.vmas, addr);
+
+	if (v != NULL && v->start == addr && VM_TYPE (v->type) == VM_FILE)
+		vm_unmap_region (v->start, (v->end - v->start) / PGSIZE);
 }
@@ -0,0 +1,275 @@
+/* ksm.c: Merging of anonymous frames with the same contents.
+ *
+ * Processes often hold many anonymous pages with the same
+ * contents: buffers filled the same way, tables built from the
+ * same input, pages zeroed and written back with zeros.  A thread
+ * of the lowest priority walks the frames of the replacement
+ * policy in a ring, and merges each frame that matches another
+ * into it: the pages of both then share one read-only frame, copy
+ * on write, and the other frame is freed.
+ *
+ * A frame is only merged once its checksum is the same on two
+ * scans in a row, since a frame that is being written would only
+ * be copied again soon.  Such a stable frame goes into a table by
+ * checksum, where later frames with the same checksum find it.  A
+ * checksum is only a hint: vm_merge_frames() compares the
+ * contents, once both frames are write-protected.
+ *
+ * The thread scans KSM_BATCH frames at a time, then sleeps long
+ * enough that scanning takes no more than ksm_cpu_percent of the
+ * time, as measured by timer ticks. */
+
+#include "vm/ksm.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+/* Frames scanned between sleeps. */
+#define KSM_BATCH 64
+
+unsigned ksm_cpu_percent = 0;
+
+/* The frames to scan, in the order they are scanned, and the next
+ * one to scan.  The frames in STABLE are among them.  FRAME_LOCK
+ * guards all of these, and the ksm fields of every frame. */
+static struct list frames;
+static struct list_elem *cursor;
+static struct hash stable;
+
+/* Statistics. */
+static int64_t start_ticks;     /* When the thread started. */
+static int64_t busy_ticks;      /* Ticks spent scanning. */
+static uint64_t scan_cnt;       /* Frames scanned. */
+static uint64_t pass_cnt;       /* Passes over all the frames. */
+static uint64_t merge_cnt;      /* Frames freed by a merge. */
+
+static thread_func ksm_daemon;
+static hash_hash_func stable_hash;
+static hash_less_func stable_less;
+
+/* Starts the scanning thread, unless -ksm=0 turned it off.  Must
+ * be called after thread_start(). */
+void
+ksm_init (void) {
+	list_init (&frames);
+	cursor = list_end (&frames);
+	hash_init (&stable, stable_hash, stable_less, NULL);
+	if (ksm_cpu_percent == 0)
+		return;
+	if (ksm_cpu_percent > 100)
+		ksm_cpu_percent = 100;
+	start_ticks = timer_ticks ();
+	thread_create ("ksmd", PRI_MIN, ksm_daemon, NULL);
+}
+
+/* Adds FRAME, whose pages were just mapped, to the frames to
+ * scan.  FRAME_LOCK must be held. */
+void
+ksm_insert (struct frame *frame) {
+	if (ksm_cpu_percent == 0)
+		return;
+	list_push_back (&frames, &frame->ksm_elem);
+	frame->checksum = 0;
+	frame->ksm_stable = false;
+	frame->ksm_merged = false;
+}
+
+/* Takes FRAME, which is about to be evicted or freed, out of the
+ * frames to scan.  FRAME_LOCK must be held. */
+void
+ksm_remove (struct frame *frame) {
+	if (ksm_cpu_percent == 0)
+		return;
+	if (cursor == &frame->ksm_elem)
+		cursor = list_next (cursor);
+	list_remove (&frame->ksm_elem);
+	if (frame->ksm_stable)
+		hash_delete (&stable, &frame->ksm_hash_elem);
+}
+
+/* Returns a hash of the page of memory at KVA. */
+static uint64_t
+checksum (const void *kva) {
+	const uint64_t *w = kva;
+	uint64_t h = 14695981039346656037ULL;
+	size_t i;
+
+	for (i = 0; i < PGSIZE / sizeof *w; i++)
+		h = (h ^ w[i]) * 1099511628211ULL;
+	return h;
+}
+
+/* Returns a hash value for the stable frame that E is in. */
+static uint64_t
+stable_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_entry (e, struct frame, ksm_hash_elem)->checksum;
+}
+
+/* Returns true if the checksum of the stable frame that A is in
+ * is less than that of the one B is in.  The table thus holds at
+ * most one frame per checksum. */
+static bool
+stable_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct frame, ksm_hash_elem)->checksum
+		< hash_entry (b, struct frame, ksm_hash_elem)->checksum;
+}
+
+/* Takes FRAME out of the stable table, if it is in it. */
+static void
+unstable (struct frame *frame) {
+	if (frame->ksm_stable) {
+		hash_delete (&stable, &frame->ksm_hash_elem);
+		frame->ksm_stable = false;
+	}
+}
+
+/* Returns true if FRAME may be merged: it holds anonymous pages
+ * that are all mapped, and is not text, which has a table of its
+ * own in vm.c. */
+static bool
+mergeable (struct frame *frame) {
+	struct list_elem *e;
+
+	if (frame->pinned || frame->inode != NULL)
+		return false;
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (page->operations->type != VM_ANON
+				|| pml4_get_page (page->pml4, page->va) != frame->kva)
+			return false;
+	}
+	return true;
+}
+
+/* Scans FRAME.  If its contents did not change since the last
+ * scan, merges it into the stable frame with the same contents,
+ * or makes it that frame if there is none.  FRAME_LOCK must be
+ * held. */
+static void
+scan_frame (struct frame *frame) {
+	uint64_t sum;
+	struct hash_elem *e;
+	struct frame *other;
+
+	if (!mergeable (frame))
+		return;
+	scan_cnt++;
+	sum = checksum (frame->kva);
+	if (sum != frame->checksum) {
+		unstable (frame);
+		frame->checksum = sum;
+		return;
+	}
+	if (frame->ksm_stable)
+		return;
+
+	e = hash_insert (&stable, &frame->ksm_hash_elem);
+	if (e == NULL) {
+		frame->ksm_stable = true;
+		return;
+	}
+	other = hash_entry (e, struct frame, ksm_hash_elem);
+	if (mergeable (other) && vm_merge_frames (other, frame)) {
+		other->ksm_merged = true;
+		merge_cnt++;
+		return;
+	}
+
+	/* OTHER changed since it was scanned, or only its checksum
+	 * matched.  FRAME takes its place. */
+	unstable (other);
+	hash_insert (&stable, &frame->ksm_hash_elem);
+	frame->ksm_stable = true;
+}
+
+/* Scans up to CNT frames, and returns how many there were. */
+static size_t
+ksm_scan (size_t cnt) {
+	size_t i;
+
+	for (i = 0; i < cnt; i++) {
+		struct frame *frame;
+
+		lock_acquire (&frame_lock);
+		if (list_empty (&frames)) {
+			lock_release (&frame_lock);
+			break;
+		}
+		if (cursor == list_end (&frames)) {
+			cursor = list_begin (&frames);
+			pass_cnt++;
+		}
+		frame = list_entry (cursor, struct frame, ksm_elem);
+		cursor = list_next (cursor);
+		scan_frame (frame);
+		lock_release (&frame_lock);
+	}
+	return i;
+}
+
+/* Scanning thread.  A batch rarely takes a whole tick, but it
+ * takes one whenever a timer interrupt comes in the middle of it,
+ * so that over many batches the ticks counted track the time
+ * spent.  The budget is kept over windows of a second, so that
+ * idle time does not build up credit for a long burst. */
+static void
+ksm_daemon (void *aux UNUSED) {
+	int64_t window = timer_ticks (), busy = 0;
+
+	for (;;) {
+		int64_t start = timer_ticks (), ticks;
+		size_t cnt = ksm_scan (KSM_BATCH);
+
+		ticks = timer_elapsed (start);
+		busy += ticks;
+		busy_ticks += ticks;
+		if (cnt == 0)
+			ticks = TIMER_FREQ;
+		else
+			ticks = busy * 100 / ksm_cpu_percent - timer_elapsed (window);
+		timer_sleep (ticks > 1 ? ticks : 1);
+
+		if (timer_elapsed (window) >= TIMER_FREQ) {
+			window = timer_ticks ();
+			busy = 0;
+		}
+	}
+}
+
+/* Prints statistics, if the scanner ran.  A frame that KSM merged
+ * pages into counts as shared while it backs more than one page;
+ * each page beyond the first saves a frame. */
+void
+ksm_print_stats (void) {
+	int64_t elapsed;
+	size_t shared = 0, saved = 0;
+	struct list_elem *e;
+
+	if (ksm_cpu_percent == 0)
+		return;
+	for (e = list_begin (&frames); e != list_end (&frames); e = list_next (e)) {
+		struct frame *frame = list_entry (e, struct frame, ksm_elem);
+
+		if (frame->ksm_merged && frame->ref_cnt > 1) {
+			shared++;
+			saved += frame->ref_cnt - 1;
+		}
+	}
+	elapsed = timer_elapsed (start_ticks);
+	printf ("KSM: %zu frames shared, %zu pages saved, %llu frames merged\n",
+			shared, saved, merge_cnt);
+	printf ("KSM: %llu frames scanned in %llu passes, %lld per second, "
+			"%lld%% of the CPU\n", scan_cnt, pass_cnt,
+			elapsed > 0 ? (int64_t) scan_cnt * TIMER_FREQ / elapsed : 0,
+			elapsed > 0 ? busy_ticks * 100 / elapsed : 0);
+}
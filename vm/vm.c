@@ -1,8 +1,70 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "intrinsic.h"
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
+#include "vm/evict.h"
 #include "vm/inspect.h"
+#include "vm/ksm.h"
+
+/* Caches of `struct page's, `struct frame's and `struct vma's. */
+static struct kmem_cache *page_obj_cache;
+static struct kmem_cache *frame_obj_cache;
+static struct kmem_cache *vma_cache;
+
+/* Maximum size of a user stack. */
+#define STACK_LIMIT (1 << 20)
+
+/* Most pages vm_evict_frame() evicts at once. */
+#define EVICT_BATCH 8
+
+/* Number of pages in a huge (2 MB) page. */
+#define HUGE_PAGE_CNT (LARGE_PGSIZE / PGSIZE)
+
+/* Guards the replacement policy's frame table, and every frame's
+ * link to its page.  Eviction releases it while it writes pages
+ * out; see vm_evict_frame(). */
+struct lock frame_lock;
+
+/* Signaled when vm_evict_frame() is done with the frames it was
+ * evicting, and how many evictions are writing pages out.  Both
+ * go with FRAME_LOCK. */
+static struct condition evict_done;
+static int evict_busy;
+
+/* Frames that hold text, by inode and offset.  Also guarded by
+ * FRAME_LOCK.  A frame is in the table exactly as long as it backs
+ * a page, so the inode it names is open. */
+static struct hash text_frames;
+
+/* A frame of zeros, mapped read-only for reads of anonymous pages
+ * that were never written.  It stays pinned, so it is never
+ * evicted, and is never freed. */
+static struct frame *zero_frame;
+static struct frame *frame_create (void *kva);
+static hash_hash_func text_hash;
+static hash_less_func text_less;
+
+/* Statistics. */
+static uint64_t fault_cnt;      /* Faults resolved. */
+static uint64_t fault_cycles;   /* ...and the TSC cycles they took. */
+static uint64_t huge_cnt;       /* Faults resolved with a huge page. */
+static uint64_t huge_small_cnt; /* ...that had to map 4 kB pages instead. */
+static uint64_t evict_cnt;      /* Frames evicted. */
+static uint64_t evict_dirty_cnt;  /* ...of which held a dirty page. */
+static uint64_t pagein_cnt;     /* Pages read back after eviction. */
+static uint64_t cow_share_cnt;  /* Pages shared with a child on fork. */
+static uint64_t cow_copy_cnt;   /* ...that were copied on a write. */
+static uint64_t text_share_cnt; /* Text faults served by another's frame. */
+static uint64_t zero_map_cnt;   /* Read faults served by ZERO_FRAME. */
+static uint64_t zero_copy_cnt;  /* ...that were written to later. */
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -15,7 +77,18 @@ vm_init (void) {
 #endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	page_obj_cache = kmem_cache_create ("page", sizeof (struct page), 0, NULL);
+	frame_obj_cache = kmem_cache_create ("frame", sizeof (struct frame), 0,
+			NULL);
+	vma_cache = kmem_cache_create ("vma", sizeof (struct vma), 0, NULL);
+	evict_policy->init ();
+	lock_init (&frame_lock);
+	cond_init (&evict_done);
+	hash_init (&text_frames, text_hash, text_less, NULL);
+	zero_frame = frame_create (palloc_get_page (PAL_ASSERT | PAL_ZERO));
+	if (zero_frame == NULL)
+		PANIC ("no memory for the zero frame");
+	ksm_init ();
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -35,156 +108,1289 @@ page_get_type (struct page *page) {
 /* Helpers */
 static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
+static bool vm_claim_text (struct page *page);
+static bool vm_claim_zero (struct page *page);
+static bool vm_claim_huge (struct page *page);
 static struct frame *vm_evict_frame (void);
+static void vm_free_frame (struct page *page, struct mmu_gather *tlb);
+static void vm_unclaim (struct page *page);
+static struct vma *vma_create (enum vm_type, void *start, size_t page_cnt,
+		bool writable);
+static bool spt_add_region (struct supplemental_page_table *, struct vma *);
+static bool spt_unmap (struct supplemental_page_table *, uint8_t *start,
+		uint8_t *end, struct mmu_gather *);
+static struct page *spt_get_page (struct supplemental_page_table *,
+		void *va);
+static bool vma_read_page (struct page *, void *aux);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
- * `vm_alloc_page`. */
+ * `vm_alloc_page`.
+ *
+ * The page becomes a one-page region; the `struct page' itself is only
+ * created when the page is first touched. */
 bool
 vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 		vm_initializer *init, void *aux) {
+	struct vma *v;
 
 	ASSERT (VM_TYPE(type) != VM_UNINIT)
 
-	struct supplemental_page_table *spt = &thread_current ()->spt;
+	v = vma_create (type, upage, 1, writable);
+	if (v == NULL)
+		return false;
+	v->init = init;
+	v->aux = aux;
+	return spt_add_region (&thread_current ()->spt, v);
+}
+
+/* Maps PAGE_CNT pages at START, which must be page-aligned, as a
+ * single region of pages of TYPE.  The first READ_BYTES bytes are
+ * read from FILE, starting at OFS, when first touched; the rest is
+ * zero.  FILE may be null if READ_BYTES is 0.  The region keeps its
+ * own handle on FILE.
+ *
+ * Fails if part of the range is mapped already or lies outside user
+ * space, or if memory is short.  Nothing is allocated per page. */
+bool
+vm_map_region (enum vm_type type, void *start, size_t page_cnt,
+		bool writable, struct file *file, off_t ofs, size_t read_bytes) {
+	struct vma *v;
+
+	ASSERT (pg_ofs (start) == 0);
+	ASSERT (read_bytes <= page_cnt * PGSIZE);
+
+	if (page_cnt == 0 || !is_user_vaddr (start)
+			|| page_cnt > (size_t) ((uint8_t *) KERN_BASE - (uint8_t *) start)
+				/ PGSIZE)
+		return false;
+
+	v = vma_create (type, start, page_cnt, writable);
+	if (v == NULL)
+		return false;
+	if (read_bytes > 0) {
+		v->file = file_reopen (file);
+		if (v->file == NULL) {
+			kmem_cache_free (vma_cache, v);
+			return false;
+		}
+		v->offset = ofs;
+		v->read_bytes = read_bytes;
+	}
+	if (!spt_add_region (&thread_current ()->spt, v)) {
+		if (v->file != NULL)
+			file_close (v->file);
+		kmem_cache_free (vma_cache, v);
+		return false;
+	}
+	return true;
+}
+
+/* Unmaps the PAGE_CNT pages at START from the running process,
+ * freeing those that were touched.  Regions that extend past either
+ * end keep their part outside the range.  Pages in the range that
+ * are not mapped are ignored.  Returns false if memory for splitting
+ * a region could not be had, in which case only part of the range
+ * may have been unmapped. */
+bool
+vm_unmap_region (void *start, size_t page_cnt) {
+	struct mmu_gather tlb;
+	bool success;
+
+	ASSERT (pg_ofs (start) == 0);
+
+	mmu_gather_init (&tlb, thread_current ()->pml4);
+	success = spt_unmap (&thread_current ()->spt, start,
+			(uint8_t *) start + page_cnt * PGSIZE, &tlb);
+	mmu_gather_finish (&tlb);
+	return success;
+}
+
+/* Returns a new VMA of PAGE_CNT pages of TYPE at START, with no
+ * backing and no pages, or a null pointer if memory is short. */
+static struct vma *
+vma_create (enum vm_type type, void *start, size_t page_cnt,
+		bool writable) {
+	struct vma *v = kmem_cache_alloc (vma_cache);
+
+	if (v != NULL) {
+		v->start = start;
+		v->end = v->start + page_cnt * PGSIZE;
+		v->type = type;
+		v->writable = writable;
+		v->file = NULL;
+		v->offset = 0;
+		v->read_bytes = 0;
+		v->init = NULL;
+		v->aux = NULL;
+		list_init (&v->pages);
+	}
+	return v;
+}
+
+/* Returns true if pages of TYPE and WRITABLE, zero-filled, can be
+ * added to V, which may be null. */
+static bool
+vma_mergeable (const struct vma *v, enum vm_type type, bool writable) {
+	return v != NULL && v->type == type && v->writable == writable
+		&& v->file == NULL && v->init == NULL;
+}
+
+/* Moves the pages of SRC to DST. */
+static void
+vma_take_pages (struct vma *dst, struct vma *src) {
+	while (!list_empty (&src->pages)) {
+		struct page *p = list_entry (list_pop_front (&src->pages),
+				struct page, vma_elem);
+		p->vma = dst;
+		list_push_back (&dst->pages, &p->vma_elem);
+	}
+}
+
+/* Adds the new region V, which has no pages yet, to SPT.  A
+ * zero-fill region is merged into adjacent regions like it, so that
+ * a stack grown one page at a time stays a single region.  Fails
+ * if V overlaps a region of SPT; then the caller still owns V. */
+static bool
+spt_add_region (struct supplemental_page_table *spt, struct vma *v) {
+	struct vma *prev, *next;
+
+	if (vma_first_overlap (&spt->vmas, v->start, v->end) != NULL)
+		return false;
+	if (!vma_mergeable (v, v->type, v->writable))
+		return vma_insert (&spt->vmas, v);
 
-	/* Check wheter the upage is already occupied or not. */
-	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+	prev = vma_find (&spt->vmas, v->start - 1);
+	next = vma_find (&spt->vmas, v->end);
+	if (vma_mergeable (prev, v->type, v->writable)) {
+		prev->end = v->end;
+		if (vma_mergeable (next, v->type, v->writable)) {
+			vma_remove (&spt->vmas, next);
+			prev->end = next->end;
+			vma_take_pages (prev, next);
+			kmem_cache_free (vma_cache, next);
+		}
+		vma_update (prev);
+	} else if (vma_mergeable (next, v->type, v->writable)) {
+		next->start = v->start;
+		vma_update (next);
+	} else
+		return vma_insert (&spt->vmas, v);
 
-		/* TODO: Insert the page into the spt. */
+	kmem_cache_free (vma_cache, v);
+	return true;
+}
+
+/* Splits V, a region of SPT, at AT, which must lie strictly inside
+ * it.  V keeps the part below AT.  Returns false if memory is
+ * short. */
+static bool
+vma_split (struct supplemental_page_table *spt, struct vma *v, uint8_t *at) {
+	size_t lo_bytes = at - v->start;
+	struct vma *hi = vma_create (v->type, at, (v->end - at) / PGSIZE,
+			v->writable);
+	struct list_elem *e;
+
+	ASSERT (at > v->start && at < v->end);
+
+	if (hi == NULL)
+		return false;
+	if (v->read_bytes > lo_bytes) {
+		hi->file = file_reopen (v->file);
+		if (hi->file == NULL) {
+			kmem_cache_free (vma_cache, hi);
+			return false;
+		}
+		hi->offset = v->offset + lo_bytes;
+		hi->read_bytes = v->read_bytes - lo_bytes;
+		v->read_bytes = lo_bytes;
+	}
+	hi->init = v->init;
+	hi->aux = v->aux;
+
+	for (e = list_begin (&v->pages); e != list_end (&v->pages); ) {
+		struct page *p = list_entry (e, struct page, vma_elem);
+
+		e = list_next (e);
+		if ((uint8_t *) p->va >= at) {
+			list_remove (&p->vma_elem);
+			p->vma = hi;
+			list_push_back (&hi->pages, &p->vma_elem);
+		}
 	}
-err:
-	return false;
+
+	v->end = at;
+	vma_update (v);
+	if (!vma_insert (&spt->vmas, hi))
+		NOT_REACHED ();
+	return true;
 }
 
-/* Find VA from spt and return page. On error, return NULL. */
+/* Frees V, which was removed from SPT, and its pages, as part of
+ * the batch of unmaps in TLB. */
+static void
+vma_destroy (struct supplemental_page_table *spt, struct vma *v,
+		struct mmu_gather *tlb) {
+	while (!list_empty (&v->pages)) {
+		struct page *p = list_entry (list_pop_front (&v->pages),
+				struct page, vma_elem);
+
+		hash_delete (&spt->pages, &p->spt_elem);
+		vm_release_page (p, tlb);
+	}
+	if (v->file != NULL)
+		file_close (v->file);
+	kmem_cache_free (vma_cache, v);
+}
+
+/* Removes [START, END) from the regions of SPT, freeing the pages
+ * there as part of TLB.  See vm_unmap_region(). */
+static bool
+spt_unmap (struct supplemental_page_table *spt, uint8_t *start,
+		uint8_t *end, struct mmu_gather *tlb) {
+	struct vma *v;
+
+	while ((v = vma_first_overlap (&spt->vmas, start, end)) != NULL) {
+		if (v->start < start) {
+			/* The part from START on is found next time round. */
+			if (!vma_split (spt, v, start))
+				return false;
+			continue;
+		}
+		if (v->end > end && !vma_split (spt, v, end))
+			return false;
+		vma_remove (&spt->vmas, v);
+		vma_destroy (spt, v, tlb);
+	}
+	return true;
+}
+
+/* Find VA from spt and return page. On error, return NULL.
+ * Only pages that were touched have a `struct page'; see
+ * spt_get_page(). */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	struct page key;
+	struct hash_elem *e;
+
+	key.va = pg_round_down (va);
+	e = hash_find (&spt->pages, &key.spt_elem);
+	return e != NULL ? hash_entry (e, struct page, spt_elem) : NULL;
+}
 
+/* Returns the page at VA in SPT, creating it, uninitialized, from
+ * the region around VA if this is the first time it is asked for.
+ * Returns a null pointer if VA is in no region, or if memory is
+ * short. */
+static struct page *
+spt_get_page (struct supplemental_page_table *spt, void *va) {
+	struct page *page = spt_find_page (spt, va);
+	struct vma *v;
+
+	if (page != NULL)
+		return page;
+	v = vma_find (&spt->vmas, va);
+	if (v == NULL)
+		return NULL;
+
+	page = kmem_cache_alloc (page_obj_cache);
+	if (page == NULL)
+		return NULL;
+	uninit_new (page, pg_round_down (va),
+			v->file != NULL ? vma_read_page : v->init, v->type, v->aux,
+			VM_TYPE (v->type) == VM_FILE
+			? file_backed_initializer : anon_initializer);
+	page->writable = v->writable;
+	page->pml4 = thread_current ()->pml4;
+	page->vma = v;
+	list_push_back (&v->pages, &page->vma_elem);
+	spt_insert_page (spt, page);
 	return page;
 }
 
+/* Initializer of the pages of file-backed regions: reads PAGE's
+ * part of its region's file into its frame. */
+static bool
+vma_read_page (struct page *page, void *aux UNUSED) {
+	return vma_read (page->vma, page->va, page->frame->kva);
+}
+
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
-
-	return succ;
+spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
+	ASSERT (pg_ofs (page->va) == 0);
+	return hash_insert (&spt->pages, &page->spt_elem) == NULL;
 }
 
+/* Unmaps PAGE from SPT and frees it. */
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
-	vm_dealloc_page (page);
-	return true;
+	struct mmu_gather tlb;
+
+	mmu_gather_init (&tlb, thread_current ()->pml4);
+	spt_unmap (spt, page->va, (uint8_t *) page->va + PGSIZE, &tlb);
+	mmu_gather_finish (&tlb);
+}
+
+/* Returns a new frame for KVA, or a null pointer if memory is
+ * short.  The frame is pinned: the replacement policy only gets it
+ * once frame_unpin() says that its page is mapped. */
+static struct frame *
+frame_create (void *kva) {
+	struct frame *frame = kmem_cache_alloc (frame_obj_cache);
+
+	if (frame != NULL) {
+		frame->kva = kva;
+		frame->page = NULL;
+		list_init (&frame->pages);
+		frame->ref_cnt = 0;
+		frame->pinned = true;
+		frame->evicting = false;
+		frame->inode = NULL;
+	}
+	return frame;
+}
+
+/* Makes FRAME back PAGE, too.  FRAME_LOCK must be held, unless
+ * FRAME is pinned. */
+static void
+frame_attach (struct frame *frame, struct page *page) {
+	list_push_back (&frame->pages, &page->frame_elem);
+	if (frame->ref_cnt++ == 0)
+		frame->page = page;
+	page->frame = frame;
+}
+
+/* Makes PAGE's frame stop backing it, and returns the frame.
+ * FRAME_LOCK must be held, unless the frame is pinned. */
+static struct frame *
+frame_detach (struct page *page) {
+	struct frame *frame = page->frame;
+
+	list_remove (&page->frame_elem);
+	frame->ref_cnt--;
+	frame->page = frame->ref_cnt > 0
+		? list_entry (list_front (&frame->pages), struct page, frame_elem)
+		: NULL;
+	page->frame = NULL;
+	if (frame->ref_cnt == 0 && frame->inode != NULL) {
+		hash_delete (&text_frames, &frame->text_elem);
+		frame->inode = NULL;
+	}
+	return frame;
+}
+
+/* Waits until PAGE's frame, if it has one, is not being evicted.
+ * Eviction writes pages out with FRAME_LOCK released, and nobody
+ * else may change or take their frames meanwhile.  FRAME_LOCK
+ * must be held. */
+static void
+frame_wait (struct page *page) {
+	while (page->frame != NULL && page->frame->evicting)
+		cond_wait (&evict_done, &frame_lock);
+}
+
+/* Returns a hash value for the text frame that E is in. */
+static uint64_t
+text_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct frame *f = hash_entry (e, struct frame, text_elem);
+	return hash_bytes (&f->inode, sizeof f->inode) ^ hash_int (f->offset);
+}
+
+/* Returns true if the text frame that A is in precedes the one B is
+ * in. */
+static bool
+text_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct frame *a = hash_entry (a_, struct frame, text_elem);
+	const struct frame *b = hash_entry (b_, struct frame, text_elem);
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	if (a->offset != b->offset)
+		return a->offset < b->offset;
+	return a->read_bytes < b->read_bytes;
+}
+
+/* Returns true if PAGE holds text: a page of a read-only region
+ * that is read from a file.  Such a page never changes, so every
+ * process that maps the same part of the file can share its
+ * frame. */
+static bool
+is_text (const struct page *page) {
+	return page->vma->file != NULL && !page->vma->writable
+		&& VM_TYPE (page->vma->type) == VM_ANON;
+}
+
+/* Sets the key of FRAME in the text table to that of PAGE. */
+static void
+text_key (struct frame *frame, const struct page *page) {
+	frame->inode = file_get_inode (page->vma->file);
+	frame->read_bytes = vma_file_bytes (page->vma, page->va, &frame->offset);
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Returns the frame in the text table that holds the same part of
+ * the same file as PAGE, or a null pointer if there is none.
+ * FRAME_LOCK must be held. */
+static struct frame *
+text_find (const struct page *page) {
+	struct frame key;
+	struct hash_elem *e;
+
+	text_key (&key, page);
+	e = hash_find (&text_frames, &key.text_elem);
+	return e != NULL ? hash_entry (e, struct frame, text_elem) : NULL;
+}
+
+/* Unpins FRAME, whose pages are now mapped, and hands it to the
+ * replacement policy and to the merging scanner.  FRAME_LOCK must
+ * be held. */
+static void
+frame_insert (struct frame *frame) {
+	frame->pinned = false;
+	evict_policy->insert (frame);
+	ksm_insert (frame);
+}
+
+/* Takes FRAME, which is not pinned, back from the replacement
+ * policy and the merging scanner, before it is freed.  FRAME_LOCK
+ * must be held. */
+static void
+frame_remove (struct frame *frame) {
+	evict_policy->remove (frame);
+	ksm_remove (frame);
+}
+
+/* Hands FRAME, whose page is now mapped, to the replacement
+ * policy. */
+static void
+frame_unpin (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	frame_insert (frame);
+	lock_release (&frame_lock);
+}
+
+/* Get the struct frame, that will be evicted, as the policy
+ * selected with -evict sees fit.  See evict.c.  Returns a null
+ * pointer if every frame is pinned.  FRAME_LOCK must be held. */
 static struct frame *
 vm_get_victim (void) {
-	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+	struct frame *victim;
 
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	victim = evict_policy->victim ();
+	if (victim != NULL)
+		ksm_remove (victim);
 	return victim;
 }
 
+/* Writes out the CNT pages in PAGES[], at most ANON_SWAP_BATCH,
+ * for vm_evict_frame(), and detaches the ones that were from their
+ * frames.  The anonymous pages go to anon_swap_out_multiple()
+ * together.  FRAME_LOCK is released during the writes, so that
+ * other faults do not wait for the disk; the frames are marked as
+ * being evicted, so nobody else touches the pages meanwhile. */
+static void
+evict_pages (struct page **pages, size_t cnt) {
+	struct page *anon[ANON_SWAP_BATCH];
+	bool ok[ANON_SWAP_BATCH], anon_ok[ANON_SWAP_BATCH];
+	size_t anon_cnt = 0, i;
+
+	if (cnt == 0)
+		return;
+
+	lock_release (&frame_lock);
+	for (i = 0; i < cnt; i++)
+		if (pages[i]->operations->type == VM_ANON)
+			anon[anon_cnt++] = pages[i];
+		else
+			ok[i] = swap_out (pages[i]);
+	anon_swap_out_multiple (anon, anon_cnt, anon_ok);
+	lock_acquire (&frame_lock);
+
+	for (i = anon_cnt = 0; i < cnt; i++) {
+		if (pages[i]->operations->type == VM_ANON)
+			ok[i] = anon_ok[anon_cnt++];
+		if (ok[i])
+			frame_detach (pages[i]);
+	}
+}
+
 /* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+ * The frame is zeroed, and pinned for its next page.
+ * Return NULL on error.  FRAME_LOCK must be held, but is released
+ * while pages are written out.
+ *
+ * Writing pages out one at a time costs a disk command each, so
+ * this evicts up to EVICT_BATCH frames at once, and hands their
+ * anonymous pages to anon_swap_out_multiple() together, which
+ * writes them to adjacent swap slots.  The victims are pinned and
+ * marked as being evicted while that happens: the policy and the
+ * merging scanner no longer hold them, and whoever finds one of
+ * their pages waits in frame_wait().  The frames not returned go back to
+ * the page allocator for the faults that follow.  A frame shared
+ * copy-on-write is freed only if each of its pages can be swapped
+ * out; each then gets its own copy in swap. */
 static struct frame *
 vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+	struct frame *victims[EVICT_BATCH], *frame = NULL;
+	struct page *batch[ANON_SWAP_BATCH];
+	size_t cnt, batch_cnt = 0, i;
+
+	for (cnt = 0; cnt < EVICT_BATCH; cnt++) {
+		struct frame *victim = vm_get_victim ();
+		struct list_elem *e;
+		bool dirty = false;
+
+		if (victim == NULL)
+			break;
+		victims[cnt] = victim;
+		victim->pinned = true;
+		victim->evicting = true;
+
+		/* Unmap the pages first, so that they do not change while
+		 * they are written out.  The PTEs keep their dirty bits for
+		 * swap_out(). */
+		for (e = list_begin (&victim->pages); e != list_end (&victim->pages);
+				e = list_next (e)) {
+			struct page *page = list_entry (e, struct page, frame_elem);
+
+			pml4_clear_page (page->pml4, page->va);
+			dirty = dirty || pml4_is_dirty (page->pml4, page->va);
+		}
+		if (dirty)
+			evict_dirty_cnt++;
+	}
+	if (cnt == 0)
+		return NULL;
+
+	evict_busy++;
+	for (i = 0; i < cnt; i++) {
+		struct list_elem *e, *next;
+
+		for (e = list_begin (&victims[i]->pages);
+				e != list_end (&victims[i]->pages); e = next) {
+			next = list_next (e);
+			batch[batch_cnt++] = list_entry (e, struct page, frame_elem);
+			if (batch_cnt == ANON_SWAP_BATCH) {
+				evict_pages (batch, batch_cnt);
+				batch_cnt = 0;
+			}
+		}
+	}
+	evict_pages (batch, batch_cnt);
+	evict_busy--;
+
+	for (i = 0; i < cnt; i++) {
+		struct frame *victim = victims[i];
+		struct list_elem *e;
+
+		victim->evicting = false;
+		if (victim->ref_cnt > 0) {
+			/* Keep the pages that could not be swapped out. */
+			for (e = list_begin (&victim->pages); e != list_end (&victim->pages);
+					e = list_next (e)) {
+				struct page *page = list_entry (e, struct page, frame_elem);
+
+				pml4_set_page (page->pml4, page->va, victim->kva,
+						page->writable && victim->ref_cnt == 1);
+				pml4_set_dirty (page->pml4, page->va, true);
+				evict_policy->forget (page);
+			}
+			frame_insert (victim);
+			continue;
+		}
+		evict_cnt++;
 
-	return NULL;
+		if (frame == NULL) {
+			frame = victim;
+			memset (frame->kva, 0, PGSIZE);
+		} else {
+			palloc_free_page (victim->kva);
+			kmem_cache_free (frame_obj_cache, victim);
+		}
+	}
+	cond_broadcast (&evict_done, &frame_lock);
+	return frame;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * and return it.  That is, if the user pool memory is full, this function
+ * evicts the frame to get the available memory space.  The frame is zeroed
+ * and pinned; the caller unpins it once its page is mapped.
+ * Returns a null pointer if no frame can be had either way. */
 static struct frame *
 vm_get_frame (void) {
-	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+	struct frame *frame;
+	void *kva;
+
+	while ((kva = palloc_get_page (PAL_USER | PAL_ZERO)) == NULL) {
+		lock_acquire (&frame_lock);
+		frame = vm_evict_frame ();
+		if (frame == NULL && evict_busy > 0) {
+			/* Every frame is being evicted by someone else, who
+			 * frees the ones it does not need once done. */
+			cond_wait (&evict_done, &frame_lock);
+			lock_release (&frame_lock);
+			continue;
+		}
+		lock_release (&frame_lock);
+		return frame;
+	}
 
-	ASSERT (frame != NULL);
-	ASSERT (frame->page == NULL);
+	frame = frame_create (kva);
+	if (frame == NULL)
+		palloc_free_page (kva);
 	return frame;
 }
 
+/* Releases PAGE's frame, if it has one, and unmaps it from the
+ * running process through TLB.  A frame that still backs other
+ * pages stays.  FRAME_LOCK must be held. */
+static void
+vm_free_frame (struct page *page, struct mmu_gather *tlb) {
+	struct frame *frame;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (page->frame == NULL)
+		return;
+	frame = frame_detach (page);
+	mmu_gather_clear_page (tlb, page->va);
+	if (frame->ref_cnt > 0 || frame == zero_frame)
+		return;
+
+	if (!frame->pinned)
+		frame_remove (frame);
+	mmu_gather_free_page (tlb, frame->kva);
+	kmem_cache_free (frame_obj_cache, frame);
+}
+
 /* Growing the stack. */
 static void
-vm_stack_growth (void *addr UNUSED) {
+vm_stack_growth (void *addr) {
+	vm_alloc_page (VM_ANON | VM_MARKER_0, pg_round_down (addr), true);
+}
+
+/* Returns true if PAGE's frame must not be written to through
+ * PAGE: it backs other pages too, or it is the zero frame. */
+static bool
+frame_is_shared (const struct page *page) {
+	return page->frame->ref_cnt > 1 || page->frame == zero_frame;
 }
 
-/* Handle the fault on write_protected page */
+/* Handle the fault on write_protected page: a write to PAGE, of
+ * the running process, whose frame is shared copy-on-write, or is
+ * the zero frame.  The last page left on a frame just gets write
+ * access back; the others get a copy of their own. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+vm_handle_wp (struct page *page) {
+	struct frame *frame = NULL;
+	bool success = true;
+
+	if (!page->writable)
+		return false;
+
+	for (;;) {
+		lock_acquire (&frame_lock);
+		frame_wait (page);
+		if (page->frame == NULL || !frame_is_shared (page) || frame != NULL)
+			break;
+
+		/* Getting a frame may have to evict, which takes
+		 * FRAME_LOCK, so PAGE's frame may change meanwhile. */
+		lock_release (&frame_lock);
+		frame = vm_get_frame ();
+		if (frame == NULL)
+			return false;
+	}
+
+	/* If PAGE was evicted meanwhile, it faults again, and gets a
+	 * frame of its own then. */
+	if (page->frame != NULL && !frame_is_shared (page))
+		pml4_set_writable (page->pml4, page->va, true);
+	else if (page->frame != NULL) {
+		/* New frames come zeroed. */
+		if (page->frame == zero_frame)
+			zero_copy_cnt++;
+		else {
+			memcpy (frame->kva, page->frame->kva, PGSIZE);
+			cow_copy_cnt++;
+		}
+		success = pml4_set_page (page->pml4, page->va, frame->kva, true);
+		if (success) {
+			pml4_set_dirty (page->pml4, page->va, true);
+			frame_detach (page);
+			frame_attach (frame, page);
+			frame_insert (frame);
+			frame = NULL;
+		}
+	}
+	lock_release (&frame_lock);
+
+	if (frame != NULL) {
+		palloc_free_page (frame->kva);
+		kmem_cache_free (frame_obj_cache, frame);
+	}
+	return success;
+}
+
+/* Takes write access away from every page of FRAME.  Returns
+ * false if a 2 MB page that holds one of them could not be
+ * split. */
+static bool
+frame_write_protect (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (!pml4_set_writable (page->pml4, page->va, false))
+			return false;
+	}
+	return true;
+}
+
+/* Gives write access back to the pages of FRAME, if it backs only
+ * one. */
+static void
+frame_write_unprotect (struct frame *frame) {
+	struct page *page = frame->page;
+
+	if (frame->ref_cnt == 1 && page->writable)
+		pml4_set_writable (page->pml4, page->va, true);
+}
+
+/* Makes the pages of DUP share KEEP copy-on-write, if both frames
+ * have the same contents, and frees DUP.  Both must hold mapped
+ * anonymous pages.  The pages of both are write-protected before
+ * their contents are compared, so that they cannot change until
+ * the pages are moved.  Returns false, with nothing merged, if the
+ * contents differ or a 2 MB page could not be split.  FRAME_LOCK
+ * must be held. */
+bool
+vm_merge_frames (struct frame *keep, struct frame *dup) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (keep != dup);
+
+	if (!frame_write_protect (keep) || !frame_write_protect (dup)
+			|| memcmp (keep->kva, dup->kva, PGSIZE)) {
+		frame_write_unprotect (keep);
+		frame_write_unprotect (dup);
+		return false;
+	}
+
+	while (!list_empty (&dup->pages)) {
+		struct page *page = list_entry (list_front (&dup->pages),
+				struct page, frame_elem);
+
+		/* The new PTE loses the dirty bit, so a page that differs
+		 * from its copy in swap must be written out on eviction
+		 * all the same.  The PTE is already there, so that
+		 * pml4_set_page() cannot fail. */
+		if (pml4_is_dirty (page->pml4, page->va))
+			page->anon.unbacked = true;
+		frame_detach (page);
+		frame_attach (keep, page);
+		pml4_set_page (page->pml4, page->va, keep->kva, false);
+	}
+	frame_remove (dup);
+	palloc_free_page (dup->kva);
+	kmem_cache_free (frame_obj_cache, dup);
+	return true;
 }
 
 /* Return true on success */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
-	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present) {
+	struct thread *t = thread_current ();
+	struct supplemental_page_table *spt = &t->spt;
+	uint64_t start = rdtsc ();
+	struct page *page;
+	bool resident, success;
 
-	return vm_do_claim_page (page);
+	if (addr == NULL || !is_user_vaddr (addr))
+		return false;
+
+	if (!not_present) {
+		page = spt_find_page (spt, addr);
+		return page != NULL && write && vm_handle_wp (page);
+	}
+
+	page = spt_get_page (spt, addr);
+
+	/* A push may touch the stack up to 8 bytes below RSP.  Only
+	 * user faults have the user's RSP at hand. */
+	if (page == NULL && user
+			&& addr >= (void *) (f->rsp - 8)
+			&& addr >= (void *) (USER_STACK - STACK_LIMIT)
+			&& addr < (void *) USER_STACK) {
+		vm_stack_growth (addr);
+		page = spt_get_page (spt, addr);
+	}
+	if (page == NULL || (write && !page->writable))
+		return false;
+
+	/* The page may be resident but not mapped: either it was read
+	 * ahead into the swap cache, or it lost its mapping when a huge
+	 * page could not be split.  In the latter case its contents may
+	 * differ from its backing, so it must count as dirty.  If the
+	 * page is being evicted, wait for that to finish. */
+	lock_acquire (&frame_lock);
+	frame_wait (page);
+	resident = page->frame != NULL;
+	if (resident) {
+		success = pml4_set_page (t->pml4, page->va, page->frame->kva,
+				page->writable && page->frame->ref_cnt == 1);
+		if (success && !anon_readahead_hit (page))
+			pml4_set_dirty (t->pml4, page->va, true);
+	}
+	lock_release (&frame_lock);
+	if (!resident)
+		success = is_text (page) ? vm_claim_text (page)
+			: (!write && vm_claim_zero (page)) || vm_claim_huge (page)
+			|| vm_do_claim_page (page);
+
+	if (success) {
+		fault_cnt++;
+		fault_cycles += rdtsc () - start;
+	}
+	return success;
 }
 
 /* Free the page.
- * DO NOT MODIFY THIS FUNCTION. */
+ * This no longer has the skeleton's body, destroy (page) then
+ * free (page), on purpose: pages come from page_obj_cache rather
+ * than malloc(), and unmapping one must flush its TLB entry.  So
+ * this is vm_release_page() in an mmu_gather of its own. */
 void
 vm_dealloc_page (struct page *page) {
+	struct mmu_gather tlb;
+
+	mmu_gather_init (&tlb, thread_current ()->pml4);
+	vm_release_page (page, &tlb);
+	mmu_gather_finish (&tlb);
+}
+
+/* Frees PAGE, as part of a batch of unmaps collected in TLB, which
+ * must be for the running process.  Its frame is freed when TLB is
+ * finished.  PAGE must have been taken out of its spt and region
+ * already. */
+void
+vm_release_page (struct page *page, struct mmu_gather *tlb) {
+	/* Waits for the page to be written out if it is being evicted. */
+	lock_acquire (&frame_lock);
+	frame_wait (page);
+	if (page->frame == NULL)
+		evict_policy->forget (page);
 	destroy (page);
-	free (page);
+	vm_free_frame (page, tlb);
+	lock_release (&frame_lock);
+	kmem_cache_free (page_obj_cache, page);
 }
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = spt_get_page (&thread_current ()->spt, va);
 
+	if (page == NULL)
+		return false;
 	return vm_do_claim_page (page);
 }
 
+/* Makes PAGE, a page of the running process that is not resident,
+ * resident in KVA, which holds its contents, without mapping it.
+ * Its next fault then only has to map it.  Returns false if memory
+ * is short. */
+bool
+vm_cache_page (struct page *page, void *kva) {
+	struct frame *frame = frame_create (kva);
+
+	if (frame == NULL)
+		return false;
+
+	/* The PTE left behind when PAGE was evicted still has its old
+	 * accessed and dirty bits, which do not apply to KVA. */
+	pml4_set_accessed (page->pml4, page->va, false);
+	pml4_set_dirty (page->pml4, page->va, false);
+
+	lock_acquire (&frame_lock);
+	frame_attach (frame, page);
+	evict_policy->forget (page);
+	frame_insert (frame);
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Claims PAGE, which holds text, by mapping the frame of another
+ * process running the same executable if there is one.  Otherwise
+ * claims it as usual, and lets other processes find its frame. */
+static bool
+vm_claim_text (struct page *page) {
+	struct frame *frame;
+	bool success;
+
+	lock_acquire (&frame_lock);
+	while ((frame = text_find (page)) != NULL && frame->evicting)
+		cond_wait (&evict_done, &frame_lock);
+	if (frame != NULL) {
+		/* Take the contents as they are.  They can be read from the
+		 * file again, so an anonymous page without a slot will
+		 * do. */
+		if (page->operations->type == VM_UNINIT)
+			anon_initializer (page, VM_ANON, frame->kva);
+		/* The frame is in the policy already, which thus never
+		 * sees PAGE come back in; it must not stay remembered. */
+		evict_policy->forget (page);
+		frame_attach (frame, page);
+		success = pml4_set_page (page->pml4, page->va, frame->kva, false);
+		if (success)
+			text_share_cnt++;
+		else
+			frame_detach (page);
+		lock_release (&frame_lock);
+		return success;
+	}
+	lock_release (&frame_lock);
+
+	if (!vm_do_claim_page (page))
+		return false;
+
+	/* Another process may have claimed the same text meanwhile;
+	 * this frame then stays private. */
+	lock_acquire (&frame_lock);
+	frame = page->frame;
+	if (frame != NULL && frame->inode == NULL && text_find (page) == NULL) {
+		text_key (frame, page);
+		hash_insert (&text_frames, &frame->text_elem);
+	}
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Claims PAGE, which is read before it was ever written, by mapping
+ * the zero frame read-only, if PAGE's region is zero-fill
+ * anonymous memory.  The first write to PAGE gets it a frame of its
+ * own through vm_handle_wp().  Returns false, without mapping
+ * anything, if PAGE is not like that. */
+static bool
+vm_claim_zero (struct page *page) {
+	struct vma *v = page->vma;
+	bool success;
+
+	if (page->operations->type != VM_UNINIT || VM_TYPE (v->type) != VM_ANON
+			|| v->file != NULL || v->init != NULL)
+		return false;
+
+	lock_acquire (&frame_lock);
+	anon_initializer (page, VM_ANON, zero_frame->kva);
+	frame_attach (zero_frame, page);
+	success = pml4_set_page (page->pml4, page->va, zero_frame->kva, false);
+	if (success)
+		zero_map_cnt++;
+	else
+		frame_detach (page);
+	lock_release (&frame_lock);
+	return success;
+}
+
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
 	struct frame *frame = vm_get_frame ();
 
+	if (frame == NULL)
+		return false;
+
 	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	frame_attach (frame, page);
+
+	if (page->operations->type != VM_UNINIT)
+		pagein_cnt++;
+	if (!swap_in (page, frame->kva)
+			|| !pml4_set_page (page->pml4, page->va, frame->kva,
+				page->writable)) {
+		vm_unclaim (page);
+		return false;
+	}
+	frame_unpin (frame);
+	return true;
+}
+
+/* Takes back the frame of PAGE, which the running process was
+ * claiming, but failed to. */
+static void
+vm_unclaim (struct page *page) {
+	struct mmu_gather tlb;
+
+	mmu_gather_init (&tlb, thread_current ()->pml4);
+	lock_acquire (&frame_lock);
+	vm_free_frame (page, &tlb);
+	lock_release (&frame_lock);
+	mmu_gather_finish (&tlb);
+}
+
+/* Tries to claim the whole LARGE_PGSIZE-aligned region around
+ * PAGE at once, by mapping it with a single 2 MB page.  This
+ * only works if PAGE's region is zero-fill anonymous memory that
+ * covers all of it, none of which was touched yet, and a
+ * physically aligned run of frames is free.  Returns false
+ * without mapping anything otherwise, in which case the caller
+ * claims PAGE alone.
+ *
+ * Each page of the region still gets its own `struct page' and
+ * `struct frame', so that the rest of the VM treats it like any
+ * other page.  When one of them is unmapped, swapped out or has
+ * its protection changed, mmu.c splits the 2 MB mapping back into
+ * 4 kB pages.  Until then, the pages share one accessed bit and
+ * one dirty bit, so the scans of the eviction policy leave the
+ * mapping whole. */
+static bool
+vm_claim_huge (struct page *page) {
+	struct thread *t = thread_current ();
+	struct vma *v = page->vma;
+	uint8_t *base = (uint8_t *) ((uint64_t) page->va & ~(LARGE_PGSIZE - 1));
+	uint8_t *kva;
+	size_t i;
+
+	if (VM_TYPE (v->type) != VM_ANON || v->file != NULL || v->init != NULL
+			|| v->start > base || v->end < base + LARGE_PGSIZE)
+		return false;
+	for (i = 0; i < HUGE_PAGE_CNT; i++) {
+		struct page *p = spt_find_page (&t->spt, base + i * PGSIZE);
+		if (p != NULL && p->operations->type != VM_UNINIT)
+			return false;
+	}
+	for (i = 0; i < HUGE_PAGE_CNT; i++)
+		if (spt_get_page (&t->spt, base + i * PGSIZE) == NULL)
+			return false;
+
+	kva = palloc_get_huge (PAL_USER | PAL_ZERO);
+	if (kva == NULL)
+		return false;
+
+	/* Link a frame to each page, then initialize the pages, which
+	 * cannot fail for zero-fill anonymous pages. */
+	for (i = 0; i < HUGE_PAGE_CNT; i++) {
+		struct page *p = spt_find_page (&t->spt, base + i * PGSIZE);
+		struct frame *frame = frame_create (kva + i * PGSIZE);
+
+		if (frame == NULL) {
+			palloc_free_multiple (kva + i * PGSIZE, HUGE_PAGE_CNT - i);
+			while (i-- > 0)
+				vm_unclaim (spt_find_page (&t->spt, base + i * PGSIZE));
+			return false;
+		}
+		frame_attach (frame, p);
+	}
+	for (i = 0; i < HUGE_PAGE_CNT; i++) {
+		struct page *p = spt_find_page (&t->spt, base + i * PGSIZE);
+		swap_in (p, p->frame->kva);
+	}
+
+	if (pml4_set_large_page (t->pml4, base, kva, page->writable))
+		huge_cnt++;
+	else {
+		/* A page table already covers the region.  The pages are
+		 * resident now, so map them one by one. */
+		for (i = 0; i < HUGE_PAGE_CNT; i++)
+			if (!pml4_set_page (t->pml4, base + i * PGSIZE,
+						kva + i * PGSIZE, page->writable))
+				break;
+		if (i < HUGE_PAGE_CNT) {
+			/* Out of memory for a page table.  Give every frame
+			 * back, which also unmaps the pages mapped so far; the
+			 * pages stay initialized, as if evicted clean, and read
+			 * back as zeros when next claimed. */
+			for (i = 0; i < HUGE_PAGE_CNT; i++)
+				vm_unclaim (spt_find_page (&t->spt, base + i * PGSIZE));
+			return false;
+		}
+		huge_small_cnt++;
+	}
+	for (i = 0; i < HUGE_PAGE_CNT; i++)
+		frame_unpin (spt_find_page (&t->spt, base + i * PGSIZE)->frame);
+	return true;
+}
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+/* Returns a hash value for the page that E is in. */
+static uint64_t
+page_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page *p = hash_entry (e, struct page, spt_elem);
+	return hash_bytes (&p->va, sizeof p->va);
+}
 
-	return swap_in (page, frame->kva);
+/* Returns true if the page that A is in precedes the one B is in. */
+static bool
+page_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct page, spt_elem)->va
+		< hash_entry (b, struct page, spt_elem)->va;
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	vma_tree_init (&spt->vmas);
+	hash_init (&spt->pages, page_hash, page_less, NULL);
 }
 
-/* Copy supplemental page table from src to dst */
+/* Claims CHILD, a page of the running process, with the contents
+ * of SRC, the same page in the parent process. */
+static bool
+vm_copy_page (struct page *child, struct page *src) {
+	struct frame *frame = vm_get_frame ();
+	bool success;
+
+	if (frame == NULL)
+		return false;
+	frame_attach (frame, child);
+
+	/* Initialize CHILD as its own type, then overwrite it.  If SRC
+	 * was evicted, swap_in() reads it back into CHILD's frame; that
+	 * leaves SRC itself as it is. */
+	success = swap_in (child, frame->kva);
+	if (success) {
+		lock_acquire (&frame_lock);
+		frame_wait (src);
+		if (src->frame != NULL)
+			memcpy (frame->kva, src->frame->kva, PGSIZE);
+		else
+			success = swap_in (src, frame->kva);
+		lock_release (&frame_lock);
+	}
+	if (!success || !pml4_set_page (child->pml4, child->va, frame->kva,
+				child->writable)) {
+		vm_unclaim (child);
+		return false;
+	}
+
+	/* The copy is not what CHILD's backing would give back. */
+	pml4_set_dirty (child->pml4, child->va, true);
+	frame_unpin (frame);
+	return true;
+}
+
+/* Makes CHILD, a page of the running process, share the frame of
+ * SRC, the same anonymous page in the parent process, copy-on-write.
+ * Both are mapped read-only until one of them is written to; see
+ * vm_handle_wp().  Falls back to copying SRC if it is not
+ * resident. */
+static bool
+vm_share_page (struct page *child, struct page *src) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	frame_wait (src);
+	frame = src->frame;
+	if (frame == NULL || !pml4_set_writable (src->pml4, src->va, false)) {
+		lock_release (&frame_lock);
+		return vm_copy_page (child, src);
+	}
+
+	/* CHILD takes SRC's contents as they are, without initializing
+	 * them again.  Nothing but the frame holds them for CHILD,
+	 * unless they cannot have changed since its region made them. */
+	anon_initializer (child, VM_ANON, frame->kva);
+	child->anon.unbacked = child->writable && frame != zero_frame;
+	frame_attach (frame, child);
+	if (!pml4_set_page (child->pml4, child->va, frame->kva, false)) {
+		frame_detach (child);
+		if (frame->ref_cnt == 1)
+			pml4_set_writable (src->pml4, src->va, src->writable);
+		lock_release (&frame_lock);
+		return false;
+	}
+	lock_release (&frame_lock);
+	cow_share_cnt++;
+	return true;
+}
+
+/* Copy supplemental page table from src to dst.  Anonymous pages
+ * are shared copy-on-write; pages of mapped files are copied. */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct vma *v;
+
+	for (v = vma_first (&src->vmas); v != NULL; v = vma_next (v)) {
+		struct vma *c = vma_create (v->type, v->start,
+				(v->end - v->start) / PGSIZE, v->writable);
+		struct list_elem *e;
+
+		if (c == NULL)
+			return false;
+		if (v->file != NULL) {
+			c->file = file_reopen (v->file);
+			if (c->file == NULL) {
+				kmem_cache_free (vma_cache, c);
+				return false;
+			}
+		}
+		c->offset = v->offset;
+		c->read_bytes = v->read_bytes;
+		c->init = v->init;
+		c->aux = v->aux;
+		if (!vma_insert (&dst->vmas, c))
+			NOT_REACHED ();
+
+		/* Pages not touched yet are created lazily in the child,
+		 * too. */
+		for (e = list_begin (&v->pages); e != list_end (&v->pages);
+				e = list_next (e)) {
+			struct page *p = list_entry (e, struct page, vma_elem);
+			struct page *child;
+
+			if (p->operations->type == VM_UNINIT)
+				continue;
+			child = spt_get_page (dst, p->va);
+			if (child == NULL)
+				return false;
+			if (!(p->operations->type == VM_ANON
+						? vm_share_page (child, p) : vm_copy_page (child, p)))
+				return false;
+		}
+	}
+	return true;
 }
 
 /* Free the resource hold by the supplemental page table */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	struct mmu_gather tlb;
+
+	mmu_gather_init (&tlb, thread_current ()->pml4);
+	spt_unmap (spt, NULL, (uint8_t *) KERN_BASE, &tlb);
+	mmu_gather_finish (&tlb);
+	hash_destroy (&spt->pages, NULL);
+}
+
+/* Prints VM statistics. */
+void
+vm_print_stats (void) {
+	printf ("VM: %llu faults resolved, %llu with a 2 MB page\n",
+			fault_cnt, huge_cnt);
+	if (huge_small_cnt > 0)
+		printf ("VM: %llu 2 MB regions claimed at once but mapped "
+				"4 kB by 4 kB\n", huge_small_cnt);
+	printf ("VM: %llu frames evicted, %llu of them dirty, %llu page-ins\n",
+			evict_cnt, evict_dirty_cnt, pagein_cnt);
+	if (fault_cnt > 0) {
+		printf ("VM: hit ratio %llu%% (faults served without a page-in)\n",
+				(fault_cnt - pagein_cnt) * 100 / fault_cnt);
+		printf ("VM: %llu cycles per fault resolved, on average, "
+				"%llu in all\n", fault_cycles / fault_cnt, fault_cycles);
+	}
+	printf ("VM: %llu pages shared on fork, %llu copied on write\n",
+			cow_share_cnt, cow_copy_cnt);
+	printf ("VM: %llu text faults served by a shared frame\n",
+			text_share_cnt);
+	printf ("VM: %llu read faults mapped the zero frame, %llu of them "
+			"written later\n", zero_map_cnt, zero_copy_cnt);
+	evict_print_stats ();
+	anon_print_stats ();
+	ksm_print_stats ();
 }
@@ -0,0 +1,259 @@
+/* vma.c: Virtual memory areas: the interval tree that holds them,
+ * and access to their backing files.
+ *
+ * The tree is an AVL tree keyed by the start of each VMA.  Every
+ * node also records the greatest end address in its subtree, so
+ * that the VMAs overlapping a range can be found without visiting
+ * the ones that end before it.  All tree operations are
+ * O(log n). */
+
+#include "vm/vm.h"
+#include <debug.h>
+#include "filesys/file.h"
+#include "threads/vaddr.h"
+
+static int
+height (const struct vma *v) {
+	return v != NULL ? v->height : 0;
+}
+
+/* Recomputes V's height and max_end from its children. */
+static void
+update (struct vma *v) {
+	int lh = height (v->left), rh = height (v->right);
+
+	v->height = (lh > rh ? lh : rh) + 1;
+	v->max_end = v->end;
+	if (v->left != NULL && v->left->max_end > v->max_end)
+		v->max_end = v->left->max_end;
+	if (v->right != NULL && v->right->max_end > v->max_end)
+		v->max_end = v->right->max_end;
+}
+
+/* Makes NEW take OLD's place under OLD's parent. */
+static void
+replace_child (struct vma_tree *tree, struct vma *old, struct vma *new) {
+	struct vma *parent = old->parent;
+
+	if (parent == NULL)
+		tree->root = new;
+	else if (parent->left == old)
+		parent->left = new;
+	else
+		parent->right = new;
+	if (new != NULL)
+		new->parent = parent;
+}
+
+/* Rotates the subtree rooted at V to the left and returns its new
+ * root. */
+static struct vma *
+rotate_left (struct vma_tree *tree, struct vma *v) {
+	struct vma *r = v->right;
+
+	replace_child (tree, v, r);
+	v->right = r->left;
+	if (v->right != NULL)
+		v->right->parent = v;
+	r->left = v;
+	v->parent = r;
+	update (v);
+	update (r);
+	return r;
+}
+
+/* Rotates the subtree rooted at V to the right and returns its
+ * new root. */
+static struct vma *
+rotate_right (struct vma_tree *tree, struct vma *v) {
+	struct vma *l = v->left;
+
+	replace_child (tree, v, l);
+	v->left = l->right;
+	if (v->left != NULL)
+		v->left->parent = v;
+	l->right = v;
+	v->parent = l;
+	update (v);
+	update (l);
+	return l;
+}
+
+/* Restores the balance and the augmented fields from V up to the
+ * root, after a change below or at V. */
+static void
+rebalance (struct vma_tree *tree, struct vma *v) {
+	for (; v != NULL; v = v->parent) {
+		int balance = height (v->left) - height (v->right);
+
+		if (balance > 1) {
+			if (height (v->left->left) < height (v->left->right))
+				rotate_left (tree, v->left);
+			v = rotate_right (tree, v);
+		} else if (balance < -1) {
+			if (height (v->right->right) < height (v->right->left))
+				rotate_right (tree, v->right);
+			v = rotate_left (tree, v);
+		} else
+			update (v);
+	}
+}
+
+/* Initializes TREE as empty. */
+void
+vma_tree_init (struct vma_tree *tree) {
+	tree->root = NULL;
+	tree->cnt = 0;
+}
+
+/* Inserts V into TREE.  Fails, leaving TREE unchanged, if V
+ * overlaps a VMA already in it. */
+bool
+vma_insert (struct vma_tree *tree, struct vma *v) {
+	struct vma **link = &tree->root, *parent = NULL;
+
+	ASSERT (v->start < v->end);
+
+	if (vma_first_overlap (tree, v->start, v->end) != NULL)
+		return false;
+
+	while (*link != NULL) {
+		parent = *link;
+		link = v->start < parent->start ? &parent->left : &parent->right;
+	}
+	v->parent = parent;
+	v->left = v->right = NULL;
+	*link = v;
+	tree->cnt++;
+	rebalance (tree, v);
+	return true;
+}
+
+/* Removes V from TREE. */
+void
+vma_remove (struct vma_tree *tree, struct vma *v) {
+	struct vma *fix;
+
+	if (v->left != NULL && v->right != NULL) {
+		/* Put V's successor, which has no left child, in V's place. */
+		struct vma *s = v->right;
+
+		while (s->left != NULL)
+			s = s->left;
+		if (s->parent != v) {
+			fix = s->parent;
+			replace_child (tree, s, s->right);
+			s->right = v->right;
+			s->right->parent = s;
+		} else
+			fix = s;
+		replace_child (tree, v, s);
+		s->left = v->left;
+		s->left->parent = s;
+	} else {
+		fix = v->parent;
+		replace_child (tree, v, v->left != NULL ? v->left : v->right);
+	}
+	tree->cnt--;
+	rebalance (tree, fix);
+}
+
+/* Refreshes the tree after V's END changed.  V's START may move
+ * too, as long as V stays between its neighbours. */
+void
+vma_update (struct vma *v) {
+	for (; v != NULL; v = v->parent)
+		update (v);
+}
+
+/* Returns the VMA in TREE that contains VA, or a null pointer if
+ * there is none. */
+struct vma *
+vma_find (struct vma_tree *tree, const void *va) {
+	return vma_first_overlap (tree, va, (const uint8_t *) va + 1);
+}
+
+/* Returns the lowest VMA in TREE that overlaps [START, END), or a
+ * null pointer if there is none.  Use vma_next() to visit the
+ * others. */
+struct vma *
+vma_first_overlap (struct vma_tree *tree, const void *start,
+		const void *end) {
+	struct vma *v = tree->root;
+
+	while (v != NULL) {
+		if (v->left != NULL && v->left->max_end > (uint8_t *) start)
+			/* If anything overlaps, the lowest one is on the left:
+			 * everything there starts before V, so something there
+			 * overlaps unless V itself starts too late. */
+			v = v->left;
+		else if (v->start >= (uint8_t *) end)
+			return NULL;
+		else if (v->end > (uint8_t *) start)
+			return v;
+		else
+			v = v->right;
+	}
+	return NULL;
+}
+
+/* Returns the lowest VMA in TREE, or a null pointer if TREE is
+ * empty. */
+struct vma *
+vma_first (struct vma_tree *tree) {
+	struct vma *v = tree->root;
+
+	if (v != NULL)
+		while (v->left != NULL)
+			v = v->left;
+	return v;
+}
+
+/* Returns the VMA after V in address order, or a null pointer if
+ * V is the last. */
+struct vma *
+vma_next (struct vma *v) {
+	if (v->right != NULL) {
+		v = v->right;
+		while (v->left != NULL)
+			v = v->left;
+		return v;
+	}
+	while (v->parent != NULL && v->parent->right == v)
+		v = v->parent;
+	return v->parent;
+}
+
+/* Returns how many bytes of the page at UPAGE in V are backed by
+ * V's file, and stores their offset in the file in *OFS. */
+size_t
+vma_file_bytes (const struct vma *v, const void *upage, off_t *ofs) {
+	size_t page_ofs = (const uint8_t *) upage - v->start;
+
+	*ofs = v->offset + page_ofs;
+	if (page_ofs >= v->read_bytes)
+		return 0;
+	return v->read_bytes - page_ofs < PGSIZE ? v->read_bytes - page_ofs : PGSIZE;
+}
+
+/* Reads the part of V's file that backs the page at UPAGE into
+ * KVA, leaving the rest of the page alone.  Returns false if the
+ * file is shorter than V expects. */
+bool
+vma_read (const struct vma *v, const void *upage, void *kva) {
+	off_t ofs;
+	size_t n = vma_file_bytes (v, upage, &ofs);
+
+	return n == 0 || file_read_at (v->file, kva, n, ofs) == (off_t) n;
+}
+
+/* Writes the part of the page at UPAGE in V that is backed by V's
+ * file from KVA back to the file. */
+void
+vma_write (const struct vma *v, const void *upage, const void *kva) {
+	off_t ofs;
+	size_t n = vma_file_bytes (v, upage, &ofs);
+
+	if (n > 0)
+		file_write_at (v->file, kva, n, ofs);
+}
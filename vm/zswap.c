@@ -0,0 +1,202 @@
+/* zswap.c: A compressed cache of anonymous pages in front of the
+ * swap disk.
+ *
+ * Writing a page to the swap disk and reading it back costs two
+ * slow PIO transfers, while many anonymous pages are mostly zeros
+ * or otherwise compress well.  anon.c thus first tries to keep an
+ * evicted page here, compressed with lz_compress(), and only goes
+ * to the disk for the pages that do not compress.
+ *
+ * The pool is a fixed run of kernel pages, cut into CHUNK_SIZE
+ * chunks that a bitmap hands out.  Each page takes a run of
+ * adjacent chunks.  When the pool is full, the pages that were
+ * stored first are written back to the swap disk to make room.
+ * Pages leave the pool when they are swapped in: the page is then
+ * the only copy, which anon.c knows to write out on eviction. */
+
+#include "vm/zswap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <list.h>
+#include <lz.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+/* Allocation unit of the pool. */
+#define CHUNK_SIZE 64
+
+/* Pages that do not compress to this size go to the disk. */
+#define MAX_ZSIZE (PGSIZE * 3 / 4)
+
+size_t zswap_pool_pages = 256;
+
+/* The pool, or a null pointer if there is none, and its chunks in
+ * use.  The pages in the pool are on LRU, in the order they were
+ * stored.  ZSWAP_LOCK guards all of these, and the zswap fields of
+ * every anon_page. */
+static uint8_t *pool;
+static struct bitmap *chunks;
+static struct list lru;
+static struct lock zswap_lock;
+
+/* Scratch space: for lz_compress(), for its output, and for the
+ * pages written back. */
+static void *work;
+static uint8_t *cbuf;
+static uint8_t *pbuf;
+
+/* Statistics. */
+static size_t page_cnt;           /* Pages in the pool. */
+static size_t zbytes;             /* Their compressed size. */
+static uint64_t store_cnt;        /* Pages stored. */
+static uint64_t reject_cnt;       /* Pages that did not compress. */
+static uint64_t load_cnt;         /* Pages swapped in from the pool. */
+static uint64_t writeback_cnt;    /* Pages written back to disk. */
+
+/* Sets up the pool, unless -zswap=0 turned it off. */
+void
+zswap_init (void) {
+	lock_init (&zswap_lock);
+	list_init (&lru);
+	if (zswap_pool_pages == 0)
+		return;
+
+	pool = palloc_get_multiple (0, zswap_pool_pages);
+	chunks = bitmap_create (zswap_pool_pages * PGSIZE / CHUNK_SIZE);
+	work = malloc (LZ_WORK_SIZE);
+	cbuf = palloc_get_page (0);
+	pbuf = palloc_get_page (0);
+	if (pool == NULL || chunks == NULL || work == NULL || cbuf == NULL
+			|| pbuf == NULL)
+		PANIC ("no memory for a %zu-page zswap pool", zswap_pool_pages);
+}
+
+/* Returns how many chunks PAGE takes in the pool. */
+static size_t
+chunk_cnt (const struct page *page) {
+	return DIV_ROUND_UP (page->anon.zsize, CHUNK_SIZE);
+}
+
+/* Takes PAGE, which is in the pool, out of it. */
+static void
+drop (struct page *page) {
+	struct anon_page *anon_page = &page->anon;
+
+	bitmap_set_multiple (chunks, anon_page->zchunk, chunk_cnt (page), false);
+	list_remove (&anon_page->zswap_elem);
+	anon_page->zchunk = BITMAP_ERROR;
+	page_cnt--;
+	zbytes -= anon_page->zsize;
+}
+
+/* Writes the page that was stored first out to the swap disk, and
+ * takes it out of the pool.  Returns false if the pool is empty or
+ * the swap disk is full. */
+static bool
+writeback_lru (void) {
+	struct page *page;
+
+	if (list_empty (&lru))
+		return false;
+	page = list_entry (list_front (&lru), struct page, anon.zswap_elem);
+	if (lz_decompress (pool + page->anon.zchunk * CHUNK_SIZE,
+				page->anon.zsize, pbuf, PGSIZE) != PGSIZE)
+		PANIC ("zswap: corrupt page at %p", page->va);
+	if (!anon_writeback (page, pbuf))
+		return false;
+	drop (page);
+	writeback_cnt++;
+	return true;
+}
+
+/* Stores a compressed copy of KVA, the contents of PAGE, which is
+ * being evicted, in the pool.  Writes older pages back to the
+ * swap disk if it is full.  Returns false if the page does not
+ * compress well, or no room can be made. */
+bool
+zswap_store (struct page *page, const void *kva) {
+	struct anon_page *anon_page = &page->anon;
+	size_t zsize, chunk;
+
+	if (pool == NULL)
+		return false;
+
+	lock_acquire (&zswap_lock);
+	zsize = lz_compress (kva, PGSIZE, cbuf, MAX_ZSIZE, work);
+	if (zsize == 0) {
+		reject_cnt++;
+		lock_release (&zswap_lock);
+		return false;
+	}
+	while ((chunk = bitmap_scan_and_flip_next (chunks,
+					DIV_ROUND_UP (zsize, CHUNK_SIZE), false)) == BITMAP_ERROR)
+		if (!writeback_lru ()) {
+			lock_release (&zswap_lock);
+			return false;
+		}
+
+	memcpy (pool + chunk * CHUNK_SIZE, cbuf, zsize);
+	anon_page->zchunk = chunk;
+	anon_page->zsize = zsize;
+	list_push_back (&lru, &anon_page->zswap_elem);
+	page_cnt++;
+	zbytes += zsize;
+	store_cnt++;
+	lock_release (&zswap_lock);
+	return true;
+}
+
+/* Decompresses PAGE into KVA, if it is in the pool, and returns
+ * true; otherwise returns false.  Unless KEEP, the page leaves the
+ * pool. */
+bool
+zswap_load (struct page *page, void *kva, bool keep) {
+	struct anon_page *anon_page = &page->anon;
+	bool found;
+
+	if (pool == NULL)
+		return false;
+
+	lock_acquire (&zswap_lock);
+	found = anon_page->zchunk != BITMAP_ERROR;
+	if (found) {
+		if (lz_decompress (pool + anon_page->zchunk * CHUNK_SIZE,
+					anon_page->zsize, kva, PGSIZE) != PGSIZE)
+			PANIC ("zswap: corrupt page at %p", page->va);
+		if (!keep)
+			drop (page);
+		load_cnt++;
+	}
+	lock_release (&zswap_lock);
+	return found;
+}
+
+/* Takes PAGE, which is being freed, out of the pool if it is
+ * there. */
+void
+zswap_invalidate (struct page *page) {
+	if (pool == NULL)
+		return;
+
+	lock_acquire (&zswap_lock);
+	if (page->anon.zchunk != BITMAP_ERROR)
+		drop (page);
+	lock_release (&zswap_lock);
+}
+
+/* Prints zswap statistics. */
+void
+zswap_print_stats (void) {
+	if (pool == NULL)
+		return;
+	printf ("zswap: %zu pages in %zu of %zu kB, %llu stored, "
+			"%llu rejected, %llu loaded, %llu written back\n",
+			page_cnt, zbytes / 1024, zswap_pool_pages * PGSIZE / 1024,
+			store_cnt, reject_cnt, load_cnt, writeback_cnt);
+}